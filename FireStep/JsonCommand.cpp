@@ -2,46 +2,185 @@
 #ifdef CMAKE
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
 #endif
 #include "version.h"
 #include "JsonCommand.h"
 
 using namespace firestep;
 
-JsonCommand::JsonCommand() {
-    clear();
-}
+const char firestep::JSON_STREAMED[] = "";
+
+enum {
+    SCAN_VALUE, // value or, in an empty array, ']'
+    SCAN_KEY, // object key or, in an empty object, '}'
+    SCAN_COLON, // ':' after object key
+    SCAN_NEXT, // ',' or close after value
+};
 
-size_t JsonCommand::responseCapacity() {
-    return jbResponse.capacity();
+JsonCommand::JsonCommand()
+    : skipLine(false), msgpack(false) {
+    clear();
 }
 
 size_t JsonCommand::requestCapacity() {
     return jbRequest.capacity();
 }
 
-size_t JsonCommand::responseAvailable() {
-    return jbResponse.capacity() - jbResponse.size();
+void JsonCommand::responseClear() {
+    responseStatus = STATUS_EMPTY;
+    tElapsed = -1;
+    error[0] = 0;
 }
 
-void JsonCommand::responseClear() {
-    jbResponse.clear();
-    jResponseRoot = jbResponse.createObject();
-    jResponseRoot["s"] = STATUS_EMPTY;
-    jResponseRoot.asObject().createNestedObject("r");
+static bool isStreamed(JsonVariant &value) {
+    return value.is<const char *>() && value.as<const char *>() == JSON_STREAMED;
+}
+
+static void printString(Print &out, const char *s) {
+    JsonVariant js;
+    js = s;
+    js.printTo(out);
+}
+
+/**
+ * Print value as compact JSON, asking streamer for JSON_STREAMED groups
+ */
+void JsonCommand::printValue(Print &out, JsonVariant &value, const char *key,
+                             JsonStreamer *streamer) {
+    if (value.is<JsonObject&>()) {
+        JsonObject &jobj = value;
+        bool first = true;
+        out.write('{');
+        for (JsonObject::iterator it = jobj.begin(); it != jobj.end(); ++it) {
+            if (!first) {
+                out.write(',');
+            }
+            first = false;
+            printString(out, it->key);
+            out.write(':');
+            printValue(out, it->value, it->key, streamer);
+        }
+        out.write('}');
+    } else if (value.is<JsonArray&>()) {
+        JsonArray &jarr = value;
+        bool first = true;
+        out.write('[');
+        for (JsonArray::iterator it = jarr.begin(); it != jarr.end(); ++it) {
+            if (!first) {
+                out.write(',');
+            }
+            first = false;
+            printValue(out, *it, NULL, streamer);
+        }
+        out.write(']');
+    } else if (key && streamer && isStreamed(value)) {
+        streamer->streamGroup(*this, out, key, false);
+    } else {
+        value.printTo(out);
+    }
+}
+
+/**
+ * Write value as MessagePack, asking streamer for JSON_STREAMED groups
+ */
+void JsonCommand::packValue(Print &out, JsonVariant &value, const char *key,
+                            JsonStreamer *streamer) {
+    if (value.is<JsonObject&>()) {
+        JsonObject &jobj = value;
+        msgpackWriteMap(out, jobj.size());
+        for (JsonObject::iterator it = jobj.begin(); it != jobj.end(); ++it) {
+            msgpackWriteString(out, it->key);
+            packValue(out, it->value, it->key, streamer);
+        }
+    } else if (value.is<JsonArray&>()) {
+        JsonArray &jarr = value;
+        msgpackWriteArray(out, jarr.size());
+        for (JsonArray::iterator it = jarr.begin(); it != jarr.end(); ++it) {
+            packValue(out, *it, NULL, streamer);
+        }
+    } else if (key && streamer && isStreamed(value)) {
+        streamer->streamGroup(*this, out, key, true);
+    } else {
+        msgpackWriteVariant(out, value);
+    }
+}
+
+static void printResponseKey(Print &out, const char *key, bool first, bool pretty) {
+    if (!first) {
+        out.write(',');
+    }
+    if (pretty) {
+        out.println();
+    }
+    out.write('"');
+    out.print(key);
+    out.print(pretty ? "\": " : "\":");
+}
+
+/**
+ * Stream the response envelope {"s":..,"r":..,"e":..,"t":..} to out.
+ * No response tree is built: the "r" value is printed from the request
+ * tree that the controller has updated in place, and JSON_STREAMED
+ * groups are written by the streamer.
+ */
+void JsonCommand::printResponse(Print &out, bool pretty, JsonStreamer *streamer) {
+    ArduinoJson::Internals::IndentedPrint indented(out);
+    Print &print = pretty ? (Print &) indented : out;
+    print.write('{');
+    if (pretty) {
+        indented.indent();
+    }
+    printResponseKey(print, "s", true, pretty);
+    print.print((long) responseStatus);
+    printResponseKey(print, "r", false, pretty);
+    if (pretty) {
+        ArduinoJson::Internals::Prettyfier prettyfier(indented);
+        printValue(prettyfier, jResponse, NULL, streamer);
+    } else {
+        printValue(out, jResponse, NULL, streamer);
+    }
+    if (error[0]) {
+        printResponseKey(print, "e", false, pretty);
+        printString(print, error);
+    }
+    if (tElapsed >= 0) {
+        printResponseKey(print, "t", false, pretty);
+        JsonVariant jt;
+        jt = tElapsed;
+        jt.printTo(print);
+    }
+    if (pretty) {
+        indented.unindent();
+        print.println();
+    }
+    print.write('}');
 }
 
 size_t JsonCommand::requestAvailable() {
     return jbRequest.capacity() - jbRequest.size();
 }
 
+/**
+ * Reset cursors for the next command. Buffer contents are left in place:
+ * request text is terminated as it is read and error is terminated by
+ * responseClear(), so no per-command memset is needed.
+ */
 void JsonCommand::clear() {
     parsed = false;
     cmdIndex = 0;
-    memset(json, 0, sizeof(json));
-    memset(error, 0, sizeof(error));
+    json[0] = 0;
     pJsonFree = json;
+    scanDepth = 0;
+    scanQuote = 0;
+    scanEscape = false;
+    scanExpect = SCAN_VALUE;
+    scanToken = NULL;
+    scanKey = NULL;
+    decoder.clear();
     jbRequest.clear();
+    jResponse = "?";
     responseClear();
 }
 
@@ -51,8 +190,7 @@ const char * JsonCommand::getError() {
 
 Status JsonCommand::setError(Status status, const char *err) {
     snprintf(error, sizeof(error), "%s", err);
-    jResponseRoot["s"] = status;
-    jResponseRoot["e"] = error;
+    responseStatus = status;
     return status;
 }
 
@@ -75,11 +213,11 @@ Status JsonCommand::parseCore() {
             return STATUS_JSON_MEM4;
         }
         jRequestRoot = jobj;
-        jResponseRoot["r"] = jRequestRoot;
+        jResponse = jRequestRoot;
     } else {
         JsonArray &jarr = jbRequest.parseArray(json);
         if (!jarr.success()) {
-            jResponseRoot["r"] = "?";
+            jResponse = "?";
             if (requestAvailable() < 10) {
                 //TESTCOUT1("requestAvailable:", requestAvailable());
                 return STATUS_JSON_MEM1;
@@ -87,9 +225,314 @@ Status JsonCommand::parseCore() {
             return STATUS_JSON_PARSE_ERROR;
         }
         jRequestRoot = jarr;
-        jResponseRoot["r"] = jarr[0];
+        jResponse = jarr[0];
     }
-    jResponseRoot["s"] = STATUS_BUSY_PARSED;
+    responseStatus = STATUS_BUSY_PARSED;
+
+    return STATUS_BUSY_PARSED;
+}
+
+/**
+ * Build the request tree from a MessagePack command of the given length,
+ * without parsing JSON text. The buffer must outlive the request tree.
+ */
+Status JsonCommand::unpack(char *pack, size_t length) {
+    MsgPackReader reader(pack, length);
+    tStart = ticks();
+    parsed = true;
+    jRequestRoot = "?";
+    jResponse = "?";
+    Status status;
+    if (reader.isObject()) {
+        JsonObject &jobj = jbRequest.createObject();
+        status = reader.read(jobj);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        if (jobj.size() < 1) {
+            return STATUS_JSON_MEM4;
+        }
+        jRequestRoot = jobj;
+        jResponse = jRequestRoot;
+    } else {
+        JsonArray &jarr = jbRequest.createArray();
+        status = reader.read(jarr);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        jRequestRoot = jarr;
+        jResponse = jarr[0];
+    }
+    responseStatus = STATUS_BUSY_PARSED;
+
+    return STATUS_BUSY_PARSED;
+}
+
+size_t JsonCommand::jsonAvailable() {
+    return sizeof(json) - (pJsonFree - json);
+}
+
+/**
+ * Write the response envelope as a MessagePack map
+ */
+void JsonCommand::packResponse(Print &out, JsonStreamer *streamer) {
+    msgpackWriteMap(out, 2 + (error[0] ? 1 : 0) + (tElapsed >= 0 ? 1 : 0));
+    msgpackWriteString(out, "s");
+    msgpackWriteLong(out, responseStatus);
+    msgpackWriteString(out, "r");
+    packValue(out, jResponse, NULL, streamer);
+    if (error[0]) {
+        msgpackWriteString(out, "e");
+        msgpackWriteString(out, error);
+    }
+    if (tElapsed >= 0) {
+        msgpackWriteString(out, "t");
+        msgpackWriteFloat(out, tElapsed);
+    }
+}
+
+static char unescape(char c) {
+    static const char table[] = "\"\"\\\\b\bf\fn\nr\rt\t";
+    for (const char *p = table; *p; p += 2) {
+        if (*p == c) {
+            return p[1];
+        }
+    }
+    return c;
+}
+
+template<class T>
+static void scanAdd(JsonArray *pjarr, JsonObject *pjobj, const char *key, T value) {
+    if (pjarr) {
+        pjarr->add(value);
+    } else {
+        (*pjobj)[key] = value;
+    }
+}
+
+/**
+ * Build the request tree one input character at a time, so that the
+ * request is ready at EOL and malformed input is rejected as soon as it
+ * arrives. Strings and literals are decoded in place into the json buffer
+ * and the tree refers to them there.
+ */
+Status JsonCommand::scan(char c) {
+    if (scanQuote) {
+        if (scanEscape) {
+            scanEscape = false;
+            *pJsonFree++ = unescape(c);
+        } else if (c == '\\') {
+            scanEscape = true;
+        } else if (c == scanQuote) {
+            scanQuote = 0;
+            *pJsonFree++ = 0;
+            return scanString();
+        } else {
+            *pJsonFree++ = c;
+        }
+        return STATUS_WAIT_EOL;
+    }
+    if (scanToken) {
+        if (isalnum(c) || c == '-' || c == '+' || c == '.') {
+            *pJsonFree++ = c;
+            return STATUS_WAIT_EOL;
+        }
+        *pJsonFree++ = 0;
+        Status status = scanLiteral();
+        if (status < 0) {
+            return status;
+        }
+    }
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\r':
+        break;
+    case '{':
+    case '[':
+        if (scanExpect != SCAN_VALUE) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        return scanOpen(c == '[');
+    case '}':
+    case ']':
+        return scanClose(c == ']');
+    case ':':
+        if (scanExpect != SCAN_COLON) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        scanExpect = SCAN_VALUE;
+        break;
+    case ',':
+        if (scanExpect != SCAN_NEXT || scanDepth <= 0) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        scanExpect = scanArray[scanDepth-1] ? SCAN_VALUE : SCAN_KEY;
+        break;
+    case '"':
+    case '\'':
+        if (scanDepth <= 0 || (scanExpect != SCAN_VALUE && scanExpect != SCAN_KEY)) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        scanQuote = c;
+        scanToken = pJsonFree;
+        break;
+    default:
+        if (scanDepth <= 0 || scanExpect != SCAN_VALUE) {
+            return STATUS_JSON_PARSE_ERROR; // outside of top-level value
+        }
+        scanToken = pJsonFree;
+        *pJsonFree++ = c;
+        break;
+    }
+    return STATUS_WAIT_EOL;
+}
+
+Status JsonCommand::scanOpen(bool isArray) {
+    if (scanDepth < 0 || scanDepth >= JSON_SCAN_DEPTH) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    JsonArray *pjarr = scanDepth ? scanArray[scanDepth-1] : NULL;
+    JsonObject *pjobj = scanDepth ? scanObject[scanDepth-1] : NULL;
+    if (isArray) {
+        JsonArray &jarr = pjarr ? pjarr->createNestedArray() :
+                          pjobj ? pjobj->createNestedArray(scanKey) : jbRequest.createArray();
+        if (!jarr.success()) {
+            return STATUS_JSON_MEM1;
+        }
+        if (scanDepth == 0) {
+            jRequestRoot = jarr;
+        }
+        scanArray[scanDepth] = &jarr;
+        scanObject[scanDepth] = NULL;
+        scanExpect = SCAN_VALUE;
+    } else {
+        JsonObject &jobj = pjarr ? pjarr->createNestedObject() :
+                           pjobj ? pjobj->createNestedObject(scanKey) : jbRequest.createObject();
+        if (!jobj.success()) {
+            return STATUS_JSON_MEM1;
+        }
+        if (scanDepth == 0) {
+            jRequestRoot = jobj;
+        }
+        scanArray[scanDepth] = NULL;
+        scanObject[scanDepth] = &jobj;
+        scanExpect = SCAN_KEY;
+    }
+    scanDepth++;
+    return STATUS_WAIT_EOL;
+}
+
+Status JsonCommand::scanClose(bool isArray) {
+    if (scanDepth <= 0 || (scanArray[scanDepth-1] != NULL) != isArray) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    switch (scanExpect) {
+    case SCAN_NEXT:
+        break;
+    case SCAN_VALUE: // empty array
+        if (!isArray || scanArray[scanDepth-1]->size()) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        break;
+    case SCAN_KEY: // empty object
+        if (scanObject[scanDepth-1]->size()) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        break;
+    default:
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    if (--scanDepth == 0) {
+        scanDepth = -1; // top-level value is complete
+    }
+    scanExpect = SCAN_NEXT;
+    return STATUS_WAIT_EOL;
+}
+
+Status JsonCommand::scanString() {
+    const char *s = scanToken;
+    scanToken = NULL;
+    if (scanExpect == SCAN_KEY) {
+        scanKey = s;
+        scanExpect = SCAN_COLON;
+    } else {
+        scanAdd(scanArray[scanDepth-1], scanObject[scanDepth-1], scanKey, s);
+        scanExpect = SCAN_NEXT;
+    }
+    return STATUS_WAIT_EOL;
+}
+
+/**
+ * Add the number, true, false or null literal at scanToken. Numbers are
+ * converted as ArduinoJson does, keeping the decimal places given.
+ */
+Status JsonCommand::scanLiteral() {
+    char *token = scanToken;
+    JsonArray *pjarr = scanArray[scanDepth-1];
+    JsonObject *pjobj = scanObject[scanDepth-1];
+    scanToken = NULL;
+    scanExpect = SCAN_NEXT;
+    if (strcmp("true", token) == 0 || strcmp("false", token) == 0) {
+        scanAdd(pjarr, pjobj, scanKey, token[0] == 't');
+        return STATUS_WAIT_EOL;
+    }
+    if (strcmp("null", token) == 0) {
+        scanAdd(pjarr, pjobj, scanKey, (const char *) NULL);
+        return STATUS_WAIT_EOL;
+    }
+    char *endLong;
+    long value = strtol(token, &endLong, 10);
+    if (*endLong == '.' || *endLong == 'e' || *endLong == 'E') {
+        char *endDouble;
+        double dvalue = strtod(token, &endDouble);
+        if (*endDouble) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        uint8_t decimals = (uint8_t) (endDouble - endLong - 1);
+        if (pjarr) {
+            pjarr->add(dvalue, decimals);
+        } else {
+            (*pjobj)[scanKey].set(dvalue, decimals);
+        }
+    } else if (*endLong || endLong == token) {
+        return STATUS_JSON_PARSE_ERROR;
+    } else {
+        scanAdd(pjarr, pjobj, scanKey, value);
+    }
+    return STATUS_WAIT_EOL;
+}
+
+/**
+ * Finish the request tree built by scan() at EOL
+ */
+Status JsonCommand::scanEnd() {
+    if (scanDepth == 0 && scanExpect == SCAN_VALUE) {
+        return STATUS_WAIT_IDLE;	// empty command
+    }
+    parsed = true;
+    if (scanDepth >= 0) {
+        jRequestRoot = "?";
+        return STATUS_JSON_PARSE_ERROR; // EOL inside top-level value
+    }
+    if (jRequestRoot.is<JsonObject&>()) {
+        JsonObject &jobj = jRequestRoot;
+        int kids = 0;
+        for (JsonObject::iterator it = jobj.begin(); it != jobj.end(); ++it) {
+            if (!it->value.success()) {
+                return STATUS_JSON_MEM1;
+            }
+            kids++;
+        }
+        if (kids < 1) {
+            return STATUS_JSON_MEM4;
+        }
+        jResponse = jRequestRoot;
+    } else {
+        JsonArray &jarr = jRequestRoot;
+        jResponse = jarr[0];
+    }
+    responseStatus = STATUS_BUSY_PARSED;
 
     return STATUS_BUSY_PARSED;
 }
@@ -115,21 +558,45 @@ Status JsonCommand::parseInput(const char *jsonIn, Status status) {
             parsed = true;
             return STATUS_JSON_TOO_LONG;
         }
+        pJsonFree = json + strlen(json) + 1; // keep request text out of allocate()
         return parseCore();
     } else if (pJsonFree == json || status == STATUS_WAIT_EOL) {
         while (Serial.available()) {
-            if (pJsonFree - json >= MAX_JSON - 1) {
-                parsed = true;
-                return STATUS_JSON_TOO_LONG;
-            }
             char c = Serial.read();
+            if (msgpack) {
+                Status decodeStatus = decoder.decode(c, pJsonFree, json + MAX_JSON);
+                if (decodeStatus == STATUS_OK) {
+                    return unpack(json, pJsonFree - json);
+                } else if (decodeStatus < 0) {
+                    parsed = true;
+                    return decodeStatus;
+                } else if (decodeStatus == STATUS_WAIT_IDLE && pJsonFree == json &&
+                           !Serial.available()) {
+                    return STATUS_WAIT_IDLE; // resynchronizing
+                }
+                continue;
+            }
+            if (skipLine) {
+                if (ticksElapsed(ticks(), tSkip) <= SKIP_LINE_TICKS) {
+                    skipLine = (c != '\n');
+                    tSkip = ticks();
+                    continue;
+                }
+                skipLine = false; // EOL was lost; c starts a new line
+            }
             if (c == '\n') {
-                return parseCore();
-            } else {
-                *pJsonFree++ = c;
+                return scanEnd();
+            }
+            Status scanStatus = pJsonFree - json >= MAX_JSON - 1 ?
+                                STATUS_JSON_TOO_LONG : scan(c);
+            if (scanStatus < 0) {
+                parsed = true;
+                skipLine = true; // discard the rest of the line
+                tSkip = ticks();
+                return scanStatus;
             }
         }
-        return STATUS_WAIT_EOL;
+        return pJsonFree == json ? STATUS_WAIT_IDLE : STATUS_WAIT_EOL;
     } else {
         return parseCore();
     }
@@ -147,9 +614,15 @@ Status JsonCommand::parse(const char *jsonIn, Status statusIn) {
     Status status = parseInput(jsonIn, statusIn);
 
     if (status < 0) {
-        char error[100];
-        snprintf(error, sizeof(error), "{\"s\":%d}", status);
-        Serial.println(error);
+        if (msgpack) {
+            msgpackWriteMap(Serial, 1);
+            msgpackWriteString(Serial, "s");
+            msgpackWriteLong(Serial, status);
+        } else {
+            Serial.print("{\"s\":");
+            Serial.print(status, DEC);
+            Serial.println("}");
+        }
     }
     return status;
 }
@@ -11,6 +11,7 @@
 #endif
 #include "Status.h"
 #include "Machine.h"
+#include "MsgPack.h"
 
 namespace firestep {
 
@@ -20,7 +21,22 @@ namespace firestep {
 //#else
 #define JSON_REQUEST_BUFFER JSON_OBJECT_SIZE(150)
 //#endif
-#define JSON_RESPONSE_BUFFER 200
+#define JSON_SCAN_DEPTH 8 // maximum nesting of serial JSON requests
+// Discarding a rejected line stops at EOL or after this much serial silence
+#define SKIP_LINE_TICKS MS_TICKS(100)
+
+/**
+ * Group queries such as {"sys":""} are answered by setting the group value
+ * to JSON_STREAMED. The group fields are then written by a JsonStreamer as
+ * the response is printed, so they never take space in the request buffer.
+ */
+extern const char JSON_STREAMED[];
+
+class JsonCommand;
+typedef class JsonStreamer {
+public:
+    virtual void streamGroup(JsonCommand &jcmd, Print &out, const char *key, bool pack) = 0;
+} JsonStreamer;
 
 typedef class JsonCommand {
     friend class JsonController;
@@ -30,44 +46,70 @@ private:
     char json[MAX_JSON];
     char *pJsonFree;
     StaticJsonBuffer<JSON_REQUEST_BUFFER> jbRequest;
-    StaticJsonBuffer<JSON_RESPONSE_BUFFER> jbResponse;
     Quad<StepCoord> move;
     StepCoord stepRate; // steps per second
     JsonVariant jRequestRoot;
-    JsonVariant jResponseRoot;
+    JsonVariant jResponse; // response "r" value, which shares the request tree
+    Status responseStatus;
+    float tElapsed; // response "t" seconds, or negative if not set
     Ticks tStart;
     char error[8];
+    int8_t scanDepth; // bracket nesting of input line; -1 after top-level close
+    char scanQuote; // quote character of string being scanned
+    bool scanEscape;
+    uint8_t scanExpect; // SCAN_VALUE, SCAN_KEY, SCAN_COLON or SCAN_NEXT
+    char *scanToken; // start of string or literal being scanned, or NULL
+    const char *scanKey; // object key awaiting its value
+    JsonObject *scanObject[JSON_SCAN_DEPTH]; // open containers (NULL for arrays)
+    JsonArray *scanArray[JSON_SCAN_DEPTH]; // open containers (NULL for objects)
+    bool skipLine; // discard rejected input through EOL; kept across clear()
+    Ticks tSkip; // arrival of last discarded byte
+    bool msgpack; // MessagePack request and response format
+    MsgPackDecoder decoder;
 
 private:
+    Status scan(char c);
+    Status scanOpen(bool isArray);
+    Status scanClose(bool isArray);
+    Status scanString();
+    Status scanLiteral();
+    Status scanEnd();
     Status parseCore();
     Status parseInput(const char *jsonIn, Status status);
+    void printValue(Print &out, JsonVariant &value, const char *key, JsonStreamer *streamer);
+    void packValue(Print &out, JsonVariant &value, const char *key, JsonStreamer *streamer);
 public:
     JsonCommand();
     void clear();
     inline JsonVariant& requestRoot() {
         return jRequestRoot;
     }
-    inline JsonObject & response() {
-        return jResponseRoot;
-    }
     Status parse(const char *jsonIn, Status status);
+    Status unpack(char *pack, size_t length);
     bool isValid();
     inline Status getStatus() {
-        return (Status) (int32_t) jResponseRoot["s"];
+        return responseStatus;
     }
     inline void setTicks() {
-        jResponseRoot["t"] = (ticks() - tStart) / (float) TICKS_PER_SECOND;
+        tElapsed = ticksElapsed(ticks(), tStart) / (float) TICKS_PER_SECOND;
     }
     inline void setStatus(Status status) {
-        jResponseRoot["s"] = status;
+        responseStatus = status;
     }
     const char *getError();
     Status setError(Status status, const char *err);
     size_t requestAvailable();
-    size_t responseAvailable();
     size_t requestCapacity();
-    size_t responseCapacity();
     void responseClear();
+    void printResponse(Print &out, bool pretty = false, JsonStreamer *streamer = NULL);
+    void packResponse(Print &out, JsonStreamer *streamer = NULL);
+    inline void setMsgPack(bool value) {
+        msgpack = value;
+    }
+    inline bool isMsgPack() {
+        return msgpack;
+    }
+    size_t jsonAvailable();
     char * allocate(size_t length);
 } JsonCommand;
 
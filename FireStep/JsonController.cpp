@@ -8,10 +8,110 @@
 
 using namespace firestep;
 
+static const char * const axisFields[] = {
+    "dh", "en", "ho", "is", "lm", "ln", "mi", "pd", "pe",
+    "pm", "pn", "po", "ps", "sa", "tm", "tn", "ud", NULL
+};
+static const char * const sysFields[] = {
+    "ah", "as", "ch", "eu", "fr", "hp", "jp", "lb", "lh", "lp",
+    "mv", "om", "pc", "pi", "sd", "tc", "to", "tv", "v", NULL
+};
+static const char * const dimFields[] = {
+    "e", "f", "gr", "ha1", "ha2", "ha3", "mi", "pd", "re", "rf", "st", NULL
+};
+
 JsonController::JsonController(Machine& machine)
     : machine(machine) {
 }
 
+/**
+ * Field buffer for one group query field. The largest field is dim pd,
+ * an array of PROBE_DATA values.
+ */
+#define GROUP_FIELD_SIZE (JSON_OBJECT_SIZE(1)+JSON_ARRAY_SIZE(PROBE_DATA))
+
+static const char * const * groupFields(const char *key) {
+    if (strcmp("sys", key) == 0) {
+        return sysFields;
+    } else if (strcmp("dim", key) == 0) {
+        return dimFields;
+    }
+    return axisFields;
+}
+
+/**
+ * Evaluate one field of a sys, dim or axis group query into kid
+ */
+Status JsonController::processGroupField(JsonCommand &jcmd, JsonObject &kid,
+        const char *field, const char *key) {
+    const char * const *fields = groupFields(key);
+    kid[field] = "";
+    if (fields == sysFields) {
+        return processSys(jcmd, kid, field);
+    } else if (fields == dimFields) {
+        return processDimension_MTO_FPD(jcmd, kid, field);
+    }
+    return processAxis(jcmd, kid, field, key[0]);
+}
+
+/**
+ * Mark a sys, dim or axis group query for streamGroup(). The fields are
+ * evaluated once here so that any error is known before the response
+ * status is printed. Group queries have no side effects, so streamGroup()
+ * evaluates them again as it prints them.
+ */
+Status JsonController::queryGroup(JsonCommand &jcmd, JsonObject &jobj, const char *key) {
+    const char * const *fields = groupFields(key);
+    for (uint8_t i = 0; fields[i]; i++) {
+        StaticJsonBuffer<GROUP_FIELD_SIZE> jbField;
+        JsonObject &kid = jbField.createObject();
+        Status status = processGroupField(jcmd, kid, fields[i], key);
+        if (status != STATUS_OK) {
+            return status;
+        }
+    }
+    jobj[key] = JSON_STREAMED; // see streamGroup()
+    return STATUS_OK;
+}
+
+/**
+ * Write the fields of a sys, dim or axis group query to out. Each field is
+ * evaluated in its own small buffer, so the size of the response does not
+ * depend on the space left in the request buffer.
+ */
+void JsonController::streamGroup(JsonCommand &jcmd, Print &out, const char *key, bool pack) {
+    const char * const *fields = groupFields(key);
+    uint8_t n = 0;
+    while (fields[n]) {
+        n++;
+    }
+    if (pack) {
+        msgpackWriteMap(out, n);
+    } else {
+        out.write('{');
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        StaticJsonBuffer<GROUP_FIELD_SIZE> jbField;
+        JsonObject &kid = jbField.createObject();
+        processGroupField(jcmd, kid, fields[i], key); // checked by queryGroup()
+        if (pack) {
+            msgpackWriteString(out, fields[i]);
+            msgpackWriteVariant(out, kid[fields[i]]);
+        } else {
+            if (i) {
+                out.write(',');
+            }
+            out.write('"');
+            out.print(fields[i]);
+            out.print("\":");
+            kid[fields[i]].printTo(out);
+        }
+    }
+    if (!pack) {
+        out.write('}');
+    }
+}
+
 Status JsonController::setup() {
     return STATUS_OK;
 }
@@ -69,6 +169,7 @@ Status processProbeField(Machine& machine, MotorIndex iMotor, JsonCommand &jcmd,
 
 Status processHomeField(Machine& machine, AxisIndex iAxis, JsonCommand &jcmd, JsonObject &jobj, const char *key) {
     Status status = processField<StepCoord, int32_t>(jobj, key, machine.axis[iAxis].home);
+    machine.invalidateHash();
     Axis &a = machine.axis[iAxis];
     if (a.isEnabled() && a.pinMin != NOPIN) {
         jobj[key] = a.home;
@@ -81,6 +182,39 @@ Status processHomeField(Machine& machine, AxisIndex iAxis, JsonCommand &jcmd, Js
     return status;
 }
 
+/**
+ * Field names dispatch by switching on a key code that packs up to three
+ * characters into an integer, so each key is scanned once instead of being
+ * compared against every name in a strcmp chain. The case labels are
+ * compile-time constants and the compiler emits the lookup into flash.
+ */
+#define KEY_CODE(c1,c2,c3) \
+    (((uint32_t)(uint8_t)(c1)<<16) | ((uint32_t)(uint8_t)(c2)<<8) | (uint32_t)(uint8_t)(c3))
+
+/**
+ * Return key code of the first three characters of key
+ */
+uint32_t keyPrefix(const char *key) {
+    uint32_t code = 0;
+    for (int8_t i=0; i<3; i++) {
+        code = (code << 8) | (uint8_t) *key;
+        if (*key) {
+            key++;
+        }
+    }
+    return code;
+}
+
+/**
+ * Return key code of key, or 0 if key is longer than three characters
+ */
+uint32_t keyCode(const char *key) {
+    if (key[0] && key[1] && key[2] && key[3]) {
+        return 0;
+    }
+    return keyPrefix(key);
+}
+
 int axisOf(char c) {
     switch (c) {
     default:
@@ -275,10 +409,24 @@ Status JsonController::initializeStroke(JsonCommand &jcmd, JsonObject& stroke) {
     if (machine.stroke.length == 0) {
         return STATUS_STROKE_NULL_ERROR;
     }
+    for (MotorIndex i = 0; i < 4; i++) {
+        if (slen[i] == 0) { // omitted motors do not move
+            for (SegIndex s = 0; s < machine.stroke.length; s++) {
+                machine.stroke.seg[s].value[i] = 0;
+            }
+        }
+    }
     status = machine.stroke.start(ticks());
     if (status != STATUS_OK) {
         return status;
     }
+    if (machine.stroke.dEndPos.isZero()) {
+        return STATUS_BUSY_MOVING;
+    }
+    machine.beginMapStroke(machine.stroke.dEndPos);
+    if (machine.stroke.pOffset) {
+        machine.stroke.startOffset();
+    }
     return STATUS_BUSY_MOVING;
 }
 
@@ -308,6 +456,9 @@ Status JsonController::processStroke(JsonCommand &jcmd, JsonObject& jobj, const
     } else if (status == STATUS_BUSY_MOVING) {
         if (machine.stroke.curSeg < machine.stroke.length) {
             status = traverseStroke(jcmd, stroke);
+            if (status != STATUS_BUSY_MOVING) {
+                machine.endMapStroke();
+            }
         }
         if (machine.stroke.curSeg >= machine.stroke.length) {
             status = STATUS_OK;
@@ -333,8 +484,10 @@ Status JsonController::processMotor(JsonCommand &jcmd, JsonObject& jobj, const c
                 }
             }
         }
-    } else if (strcmp("ma", key) == 0 || strcmp("ma", key + 1) == 0) {
-        JsonVariant &jv = jobj[key];
+        return status;
+    }
+    switch (keyCode(strlen(key) == 3 ? key + 1 : key)) {
+    case KEY_CODE('m','a',0): {
         MotorIndex iMotor = group - '1';
         if (iMotor < 0 || MOTOR_COUNT <= iMotor) {
             return STATUS_MOTOR_INDEX;
@@ -342,6 +495,10 @@ Status JsonController::processMotor(JsonCommand &jcmd, JsonObject& jobj, const c
         AxisIndex iAxis = machine.getAxisIndex(iMotor);
         status = processField<AxisIndex, int32_t>(jobj, key, iAxis);
         machine.setAxisIndex(iMotor, iAxis);
+        break;
+    }
+    default:
+        break;
     }
     return status;
 }
@@ -361,29 +518,10 @@ Status JsonController::processAxis(JsonCommand &jcmd, JsonObject& jobj, const ch
         return STATUS_AXIS_ERROR;
     }
     Axis &axis = machine.axis[iAxis];
+    bool isAssignment = (!(s = jobj[key]) || *s != 0);
     if (strlen(key) == 1) {
         if ((s = jobj[key]) && *s == 0) {
-            JsonObject& node = jobj.createNestedObject(key);
-            node["dh"] = "";
-            node["en"] = "";
-            node["ho"] = "";
-            node["is"] = "";
-            node["lm"] = "";
-            node["ln"] = "";
-            node["mi"] = "";
-            node["pd"] = "";
-            node["pe"] = "";
-            node["pm"] = "";
-            node["pn"] = "";
-            node["po"] = "";
-            node["ps"] = "";
-            node["sa"] = "";
-            node["tm"] = "";
-            node["tn"] = "";
-            node["ud"] = "";
-            if (!node.at("ud").success()) {
-                return jcmd.setError(STATUS_JSON_KEY, "ud");
-            }
+            return queryGroup(jcmd, jobj, key);
         }
         JsonObject& kidObj = jobj[key];
         if (kidObj.success()) {
@@ -394,60 +532,85 @@ Status JsonController::processAxis(JsonCommand &jcmd, JsonObject& jobj, const ch
                 }
             }
         }
-    } else if (strcmp("en", key) == 0 || strcmp("en", key + 1) == 0) {
+        return status;
+    }
+    switch (keyCode(strlen(key) == 3 ? key + 1 : key)) {
+    case KEY_CODE('e','n',0): {
         bool active = axis.isEnabled();
         status = processField<bool, bool>(jobj, key, active);
         if (status == STATUS_OK) {
             axis.enable(active);
             status = (jobj[key] = axis.isEnabled()).success() ? status : STATUS_FIELD_ERROR;
         }
-    } else if (strcmp("dh", key) == 0 || strcmp("dh", key + 1) == 0) {
+        break;
+    }
+    case KEY_CODE('d','h',0):
         status = processField<bool, bool>(jobj, key, axis.dirHIGH);
         if (axis.pinDir != NOPIN && status == STATUS_OK) {	// force setting of direction bit in case meaning changed
             axis.setAdvancing(false);
             axis.setAdvancing(true);
         }
-    } else if (strcmp("ho", key) == 0 || strcmp("ho", key + 1) == 0) {
+        break;
+    case KEY_CODE('h','o',0):
         status = processField<StepCoord, int32_t>(jobj, key, axis.home);
-    } else if (strcmp("is", key) == 0 || strcmp("is", key + 1) == 0) {
+        break;
+    case KEY_CODE('i','s',0):
         status = processField<DelayMics, int32_t>(jobj, key, axis.idleSnooze);
-    } else if (strcmp("lb", key) == 0 || strcmp("lb", key + 1) == 0) {
+        break;
+    case KEY_CODE('l','b',0):
         status = processField<StepCoord, int32_t>(jobj, key, machine.latchBackoff);
-    } else if (strcmp("lm", key) == 0 || strcmp("lm", key + 1) == 0) {
+        break;
+    case KEY_CODE('l','m',0):
         axis.readAtMax(machine.invertLim);
         status = processField<bool, bool>(jobj, key, axis.atMax);
-    } else if (strcmp("ln", key) == 0 || strcmp("ln", key + 1) == 0) {
+        break;
+    case KEY_CODE('l','n',0):
         axis.readAtMin(machine.invertLim);
         status = processField<bool, bool>(jobj, key, axis.atMin);
-    } else if (strcmp("mi", key) == 0 || strcmp("mi", key + 1) == 0) {
+        break;
+    case KEY_CODE('m','i',0):
         status = processField<uint8_t, int32_t>(jobj, key, axis.microsteps);
         if (axis.microsteps < 1) {
             axis.microsteps = 1;
             return STATUS_JSON_POSITIVE1;
         }
-    } else if (strcmp("pd", key) == 0 || strcmp("pd", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','d',0):
         status = processPin(jobj, key, axis.pinDir, OUTPUT);
-    } else if (strcmp("pe", key) == 0 || strcmp("pe", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','e',0):
         status = processPin(jobj, key, axis.pinEnable, OUTPUT, HIGH);
-    } else if (strcmp("pm", key) == 0 || strcmp("pm", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','m',0):
         status = processPin(jobj, key, axis.pinMax, INPUT);
-    } else if (strcmp("pn", key) == 0 || strcmp("pn", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','n',0):
         status = processPin(jobj, key, axis.pinMin, INPUT);
-    } else if (strcmp("po", key) == 0 || strcmp("po", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','o',0):
         status = processField<StepCoord, int32_t>(jobj, key, axis.position);
-    } else if (strcmp("ps", key) == 0 || strcmp("ps", key + 1) == 0) {
+        break;
+    case KEY_CODE('p','s',0):
         status = processPin(jobj, key, axis.pinStep, OUTPUT);
-    } else if (strcmp("sa", key) == 0 || strcmp("sa", key + 1) == 0) {
+        break;
+    case KEY_CODE('s','a',0):
         status = processField<float, double>(jobj, key, axis.stepAngle);
-    } else if (strcmp("tm", key) == 0 || strcmp("tm", key + 1) == 0) {
+        break;
+    case KEY_CODE('t','m',0):
         status = processField<StepCoord, int32_t>(jobj, key, axis.travelMax);
-    } else if (strcmp("tn", key) == 0 || strcmp("tn", key + 1) == 0) {
+        break;
+    case KEY_CODE('t','n',0):
         status = processField<StepCoord, int32_t>(jobj, key, axis.travelMin);
-    } else if (strcmp("ud", key) == 0 || strcmp("ud", key + 1) == 0) {
+        break;
+    case KEY_CODE('u','d',0):
         status = processField<DelayMics, int32_t>(jobj, key, axis.usDelay);
-    } else {
+        break;
+    default:
         return jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
     }
+    if (isAssignment) {
+        machine.invalidateHash();
+    }
     return status;
 }
 
@@ -514,7 +677,7 @@ Status PHSelfTest::execute(JsonCommand &jcmd, JsonObject& jobj) {
         if (nLoops % 500 == 0) {
             cout << "PHSelfTest:execute()"
                  << " t:"
-                 << (threadClock.ticks - machine.stroke.tStart) /
+                 << ticksElapsed(threadClock.ticks, machine.stroke.tStart) /
                  (float) machine.stroke.get_dtTotal()
                  << " pos:"
                  << machine.getMotorPosition().toString() << endl;
@@ -528,7 +691,7 @@ Status PHSelfTest::execute(JsonCommand &jcmd, JsonObject& jobj) {
     if (status == STATUS_OK) {
         status = STATUS_BUSY_MOVING; // repeat indefinitely
     }
-    Ticks tElapsed = ticks() - tStart;
+    Ticks tElapsed = ticksElapsed(ticks(), tStart);
 
     float ts = tElapsed / (float) TICKS_PER_SECOND;
     float tp = machine.stroke.getTimePlanned();
@@ -579,6 +742,7 @@ Status PHSelfTest::process(JsonCommand& jcmd, JsonObject& jobj, const char* key)
         // output variable
     } else if (strcmp("mv", key) == 0) {
         status = processField<int32_t, int32_t>(jobj, key, machine.vMax);
+        machine.invalidateHash();
     } else if (strcmp("pp", key) == 0) {
         // output variable
     } else if (strcmp("pu", key) == 0) {
@@ -591,6 +755,7 @@ Status PHSelfTest::process(JsonCommand& jcmd, JsonObject& jobj, const char* key)
         // output variable
     } else if (strcmp("tv", key) == 0) {
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, machine.tvMax);
+        machine.invalidateHash();
     } else {
         return jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
     }
@@ -629,6 +794,10 @@ public:
     }
 
     Status process(JsonCommand& jcmd, JsonObject& jobj, const char* key);
+    Status moveTo(JsonCommand& jcmd, Quad<PH5TYPE> dest) {
+        destination = dest;
+        return execute(jcmd, NULL);
+    }
 } PHMoveTo;
 
 Status PHMoveTo::execute(JsonCommand &jcmd, JsonObject *pjobj) {
@@ -645,6 +814,7 @@ Status PHMoveTo::execute(JsonCommand &jcmd, JsonObject *pjobj) {
     case MTO_FPD:
         XYZ3D xyz(destination.value[0], destination.value[1], destination.value[2]);
         Step3D pulses(machine.delta.calcPulses(xyz));
+        curPos -= machine.mapOffset; // nominal position
         dPos.value[0] = pulses.p1 - curPos.value[0];
         dPos.value[1] = pulses.p2 - curPos.value[1];
         dPos.value[2] = pulses.p3 - curPos.value[2];
@@ -656,16 +826,28 @@ Status PHMoveTo::execute(JsonCommand &jcmd, JsonObject *pjobj) {
             dPos.value[i] = 0;
         }
     }
+    Quad<StepCoord> dMap; // height map change at an unchanged nominal position
+    if (dPos.isZero()) {
+        dMap = machine.mapCorrection();
+        for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+            if (!machine.getMotorAxis(i).isEnabled()) {
+                dMap.value[i] = 0;
+            }
+        }
+    }
     Status status = STATUS_OK;
     float tp = 0;
     float ts = 0;
     float pp = 0;
     int16_t sg = 0;
-    if (!dPos.isZero()) {
-        status = sb.buildLine(machine.stroke, dPos);
+    if (!dPos.isZero() || !dMap.isZero()) {
+        status = sb.buildLine(machine.stroke, dMap.isZero() ? dPos : dMap);
         if (status != STATUS_OK) {
             return status;
         }
+        if (dMap.isZero()) {
+            machine.beginMapStroke(dPos);
+        }
         Ticks tStrokeStart = ticks();
         status = machine.stroke.start(tStrokeStart);
         switch (status) {
@@ -680,8 +862,10 @@ Status PHMoveTo::execute(JsonCommand &jcmd, JsonObject *pjobj) {
             nLoops++;
             status = machine.stroke.traverse(ticks(), machine);
         } while (status == STATUS_BUSY_MOVING);
+        machine.endMapStroke();
+        machine.mapOffset += dMap;
         tp = machine.stroke.getTimePlanned();
-        ts = (ticks() - tStrokeStart) / (float) TICKS_PER_SECOND;
+        ts = ticksElapsed(ticks(), tStrokeStart) / (float) TICKS_PER_SECOND;
         pp = machine.stroke.vPeak * (machine.stroke.length / ts);
         sg = machine.stroke.length;
     }
@@ -810,45 +994,56 @@ Status PHMoveTo::process(JsonCommand& jcmd, JsonObject& jobj, const char* key) {
         if (status == STATUS_OK) {
             status = execute(jcmd, NULL);
         }
-    } else if (strcmp("d", key) == 0) {
-        if (!jobj.at("a").success()) {
-            return jcmd.setError(STATUS_FIELD_REQUIRED,"a");
-        }
-    } else if (strcmp("a", key) == 0) {
-        // polar CCW from X-axis around X0Y0
-        if (!jobj.at("d").success()) {
-            return jcmd.setError(STATUS_FIELD_REQUIRED,"d");
-        }
-        PH5TYPE d = jobj["d"];
-        PH5TYPE a = jobj["a"];
-        PH5TYPE pi = 3.14159265359;
-        PH5TYPE radians = a * pi / 180.0;
-        PH5TYPE y = d * sin(radians);
-        PH5TYPE x = d * cos(radians);
-        TESTCOUT2("x:", x, " y:", y);
-        destination.value[0] = x;
-        destination.value[1] = y;
-    } else if (strcmp("lp", key) == 0) {
-        // output variable
-    } else if (strcmp("mv", key) == 0) {
-        status = processField<int32_t, int32_t>(jobj, key, machine.vMax);
-    } else if (strcmp("pp", key) == 0) {
-        // output variable
-    } else if (strcmp("sg", key) == 0) {
-        status = processField<int16_t, int32_t>(jobj, key, nSegs);
-    } else if (strcmp("ts", key) == 0) {
-        // output variable
-    } else if (strcmp("tp", key) == 0) {
-        // output variable
-    } else if (strcmp("tv", key) == 0) {
-        status = processField<PH5TYPE, PH5TYPE>(jobj, key, machine.tvMax);
     } else {
-        MotorIndex iMotor = machine.motorOfName(key);
-        if (iMotor == INDEX_NONE) {
-            TESTCOUT1("STATUS_NO_MOTOR: ", key);
-            return jcmd.setError(STATUS_NO_MOTOR, key);
+        switch (keyCode(key)) {
+        case KEY_CODE('d',0,0):
+            if (!jobj.at("a").success()) {
+                return jcmd.setError(STATUS_FIELD_REQUIRED,"a");
+            }
+            break;
+        case KEY_CODE('a',0,0): {
+            // polar CCW from X-axis around X0Y0
+            if (!jobj.at("d").success()) {
+                return jcmd.setError(STATUS_FIELD_REQUIRED,"d");
+            }
+            PH5TYPE d = jobj["d"];
+            PH5TYPE a = jobj["a"];
+            PH5TYPE pi = 3.14159265359;
+            PH5TYPE radians = a * pi / 180.0;
+            PH5TYPE y = d * sin(radians);
+            PH5TYPE x = d * cos(radians);
+            TESTCOUT2("x:", x, " y:", y);
+            destination.value[0] = x;
+            destination.value[1] = y;
+            break;
+        }
+        case KEY_CODE('l','p',0):
+        case KEY_CODE('p','p',0):
+        case KEY_CODE('t','s',0):
+        case KEY_CODE('t','p',0):
+            // output variable
+            break;
+        case KEY_CODE('m','v',0):
+            status = processField<int32_t, int32_t>(jobj, key, machine.vMax);
+            machine.invalidateHash();
+            break;
+        case KEY_CODE('s','g',0):
+            status = processField<int16_t, int32_t>(jobj, key, nSegs);
+            break;
+        case KEY_CODE('t','v',0):
+            status = processField<PH5TYPE, PH5TYPE>(jobj, key, machine.tvMax);
+            machine.invalidateHash();
+            break;
+        default: {
+            MotorIndex iMotor = machine.motorOfName(key);
+            if (iMotor == INDEX_NONE) {
+                TESTCOUT1("STATUS_NO_MOTOR: ", key);
+                return jcmd.setError(STATUS_NO_MOTOR, key);
+            }
+            status = processField<PH5TYPE, PH5TYPE>(jobj, key, destination.value[iMotor]);
+            break;
+        }
         }
-        status = processField<PH5TYPE, PH5TYPE>(jobj, key, destination.value[iMotor]);
     }
     return status;
 }
@@ -919,29 +1114,11 @@ Status JsonController::processTest(JsonCommand& jcmd, JsonObject& jobj, const ch
 
 Status JsonController::processSys(JsonCommand& jcmd, JsonObject& jobj, const char* key) {
     Status status = STATUS_OK;
+    const char *s;
+    bool isAssignment = (!(s = jobj[key]) || *s != 0);
     if (strcmp("sys", key) == 0) {
-        const char *s;
         if ((s = jobj[key]) && *s == 0) {
-            JsonObject& node = jobj.createNestedObject(key);
-            node["ah"] = "";
-            node["as"] = "";
-			node["ch"] = "";
-			node["eu"] = "";
-            node["fr"] = "";
-            node["hp"] = "";
-            node["jp"] = "";
-            node["lb"] = "";
-            node["lh"] = "";
-            node["lp"] = "";
-            node["mv"] = "";
-            node["om"] = "";
-            node["pc"] = "";
-            node["pi"] = "";
-            node["sd"] = "";
-            node["tc"] = "";
-            node["to"] = "";
-            node["tv"] = "";
-            node["v"] = "";
+            return queryGroup(jcmd, jobj, key);
         }
         JsonObject& kidObj = jobj[key];
         if (kidObj.success()) {
@@ -952,11 +1129,16 @@ Status JsonController::processSys(JsonCommand& jcmd, JsonObject& jobj, const cha
                 }
             }
         }
-    } else if (strcmp("ah", key) == 0 || strcmp("sysah", key) == 0) {
+        return status;
+    }
+    switch (keyCode(strncmp("sys", key, 3) == 0 ? key + 3 : key)) {
+    case KEY_CODE('a','h',0):
         status = processField<bool, bool>(jobj, key, machine.autoHome);
-    } else if (strcmp("as", key) == 0 || strcmp("sysas", key) == 0) {
+        break;
+    case KEY_CODE('a','s',0):
         status = processField<bool, bool>(jobj, key, machine.autoSync);
-    } else if (strcmp("ch", key) == 0 || strcmp("sysch", key) == 0) {
+        break;
+    case KEY_CODE('c','h',0): {
 		int32_t curHash = machine.hash();
 		int32_t jsonHash = curHash;
 		//TESTCOUT3("A curHash:", curHash, " jsonHash:", jsonHash, " jobj[key]:", (int32_t) jobj[key]);
@@ -965,85 +1147,114 @@ Status JsonController::processSys(JsonCommand& jcmd, JsonObject& jobj, const cha
 		if (jsonHash != curHash) {
 			machine.syncHash = jsonHash;
 		}
-    } else if (strcmp("eu", key) == 0 || strcmp("syseu", key) == 0) {
+        break;
+    }
+    case KEY_CODE('e','u',0): {
 		bool euExisting = machine.isEEUserEnabled();
 		bool euNew = euExisting;
         status = processField<bool, bool>(jobj, key, euNew);
 		if (euNew != euExisting) {
 			machine.enableEEUser(euNew);
 		}
-    } else if (strcmp("db", key) == 0 || strcmp("sysdb", key) == 0) {
+        break;
+    }
+    case KEY_CODE('d','b',0):
         status = processField<uint8_t, long>(jobj, key, machine.debounce);
-    } else if (strcmp("fr", key) == 0 || strcmp("sysfr", key) == 0) {
+        break;
+    case KEY_CODE('f','r',0):
         leastFreeRam = min(leastFreeRam, freeRam());
         jobj[key] = leastFreeRam;
-    } else if (strcmp("hp", key) == 0 || strcmp("syshp", key) == 0) {
+        break;
+    case KEY_CODE('h','p',0):
         status = processField<int16_t, long>(jobj, key, machine.homingPulses);
-    } else if (strcmp("jp", key) == 0 || strcmp("sysjp", key) == 0) {
+        break;
+    case KEY_CODE('j','p',0):
         status = processField<bool, bool>(jobj, key, machine.jsonPrettyPrint);
-    } else if (strcmp("lb", key) == 0 || strcmp("lb", key + 1) == 0) {
+        break;
+    case KEY_CODE('l','b',0):
         status = processField<StepCoord, int32_t>(jobj, key, machine.latchBackoff);
-    } else if (strcmp("lh", key) == 0 || strcmp("syslh", key) == 0) {
+        break;
+    case KEY_CODE('l','h',0):
         status = processField<bool, bool>(jobj, key, machine.invertLim);
-    } else if (strcmp("lp", key) == 0 || strcmp("syslp", key) == 0) {
+        break;
+    case KEY_CODE('l','p',0):
         status = processField<int32_t, int32_t>(jobj, key, nLoops);
-    } else if (strcmp("mv", key) == 0 || strcmp("sysmv", key) == 0) {
+        break;
+    case KEY_CODE('m','v',0):
         status = processField<int32_t, int32_t>(jobj, key, machine.vMax);
-    } else if (strcmp("om", key) == 0 || strcmp("sysom", key) == 0) {
-        status = processField<OutputMode, int32_t>(jobj, key, machine.outputMode);
-    } else if (strcmp("pc", key) == 0 || strcmp("syspc", key) == 0) {
+        break;
+    case KEY_CODE('o','m',0): {
+        OutputMode om = machine.outputMode;
+        status = processField<OutputMode, int32_t>(jobj, key, om);
+        if ((om & OUTPUT_XONXOFF) && (om & OUTPUT_MSGPACK)) {
+            // XON and XOFF are also MessagePack positive fixints
+            return jcmd.setError(STATUS_VALUE_RANGE, key);
+        }
+        machine.outputMode = om;
+        break;
+    }
+    case KEY_CODE('p','c',0): {
         PinConfig pc = machine.getPinConfig();
         status = processField<PinConfig, int32_t>(jobj, key, pc);
-        const char *s;
         if ((s = jobj.at(key)) && *s == 0) { // query
             // do nothing
         } else {
             machine.setPinConfig(pc);
         }
-    } else if (strcmp("pi", key) == 0 || strcmp("syspi", key) == 0) {
+        break;
+    }
+    case KEY_CODE('p','i',0): {
         PinType pinStatus = machine.pinStatus;
         status = processField<PinType, int32_t>(jobj, key, pinStatus);
         if (pinStatus != machine.pinStatus) {
             machine.pinStatus = pinStatus;
             machine.pDisplay->setup(pinStatus);
         }
-    } else if (strcmp("sd", key) == 0 || strcmp("syssd", key) == 0) {
+        break;
+    }
+    case KEY_CODE('s','d',0):
         status = processField<DelayMics, int32_t>(jobj, key, machine.searchDelay);
-    } else if (strcmp("to", key) == 0 || strcmp("systo", key) == 0) {
+        break;
+    case KEY_CODE('t','o',0): {
         Topology value = machine.topology;
         status = processField<Topology, int32_t>(jobj, key, value);
-        if (value != machine.topology) {
-            machine.topology = value;
-            switch (machine.topology) {
-            case MTO_RAW:
-            default:
-                break;
-            case MTO_FPD:
-                machine.delta.setup();
-                if (machine.axis[0].home >= 0 &&
-                        machine.axis[1].home >= 0 &&
-                        machine.axis[2].home >= 0) {
-                    // Delta always has negateve home limit switch
-                    Step3D home = machine.delta.getHomePulses();
-                    machine.axis[0].position += home.p1-machine.axis[0].home;
-                    machine.axis[1].position += home.p2-machine.axis[1].home;
-                    machine.axis[2].position += home.p3-machine.axis[2].home;
-                    machine.axis[0].home = home.p1;
-                    machine.axis[1].home = home.p2;
-                    machine.axis[2].home = home.p3;
-                }
-                break;
+        machine.setTopology(value);
+        break;
+    }
+    case KEY_CODE('t','c',0):
+        jobj[key] = threadClock.ticks;
+        break;
+    case KEY_CODE('t','h',0): { // thread profile {id:[runCount,runTicks,runMax]}
+        if (isAssignment) {
+            threadRunner.clearProfile();
+        }
+        JsonObject& node = jobj.createNestedObject(key);
+        for (ThreadPtr pThread = pThreadList; pThread; pThread = pThread->pNext) {
+            char *id = jcmd.allocate(2);
+            if (!id) {
+                return jcmd.setError(STATUS_JSON_MEM2, key);
             }
+            id[0] = pThread->id;
+            id[1] = 0;
+            JsonArray& jarr = node.createNestedArray(id);
+            jarr.add((int32_t) pThread->runCount);
+            jarr.add((int32_t) pThread->runTicks);
+            jarr.add((int32_t) pThread->runMax);
         }
-    } else if (strcmp("tc", key) == 0 || strcmp("systc", key) == 0) {
-        jobj[key] = threadClock.ticks;
-    } else if (strcmp("tv", key) == 0 || strcmp("systv", key) == 0) {
+        return status; // profile is not configuration
+    }
+    case KEY_CODE('t','v',0):
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, machine.tvMax);
-    } else if (strcmp("v", key) == 0 || strcmp("sysv", key) == 0) {
+        break;
+    case KEY_CODE('v',0,0):
         jobj[key] = VERSION_MAJOR * 100 + VERSION_MINOR + VERSION_PATCH / 100.0;
-    } else {
+        break;
+    default:
         return jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
     }
+    if (isAssignment) {
+        machine.invalidateHash();
+    }
     return status;
 }
 
@@ -1121,30 +1332,26 @@ Status JsonController::processEEPROMValue(JsonCommand& jcmd, JsonObject& jobj, c
     if (addrLong<0 || EEPROM_END <= addrLong) {
         return STATUS_EEPROM_ADDR;
     }
-    char buf[EEPROM_BYTES];
-    buf[0] = 0;
-    if (jvalue.is<JsonArray&>()) {
-        JsonArray &jeep = jvalue;
-        jeep.printTo(buf, EEPROM_BYTES);
-    } else if (jvalue.is<JsonObject&>()) {
-        JsonObject &jeep = jvalue;
-        jeep.printTo(buf, EEPROM_BYTES);
-    } else if (jvalue.is<const char *>()) {
-        const char *s = jvalue;
-        snprintf(buf, sizeof(buf), "%s", s);
-    }
-    if (!buf) {
-        return STATUS_JSON_STRING;
-    }
-    if (buf[0] == 0) { // query
-        uint8_t c = eeprom_read_byte((uint8_t*) addrLong);
+    uint8_t *eepAddr = (uint8_t *) addrLong;
+    const char *value = "";
+    bool isJson = jvalue.is<JsonArray&>() || jvalue.is<JsonObject&>();
+    if (jvalue.is<const char *>()) {
+        value = jvalue;
+        if (!value) {
+            return STATUS_JSON_STRING;
+        }
+    }
+    if (!isJson && *value == 0) { // query
+        uint8_t c = eeprom_read_byte(eepAddr);
         if (c && c != 255) {
-            char *buf = jcmd.allocate(EEPROM_BYTES);
-            if (!buf) {
+            int16_t bufLen = (int16_t) min((size_t) EEPROM_BYTES, jcmd.jsonAvailable());
+            char *buf = jcmd.allocate(bufLen);
+            if (!buf || bufLen < 2) {
                 return jcmd.setError(STATUS_JSON_MEM3, key);
             }
-            for (int16_t i=0; i<EEPROM_BYTES; i++) {
-                c = eeprom_read_byte((uint8_t*) addrLong+i);
+            buf[bufLen-1] = 0;
+            for (int16_t i=0; i<bufLen-1; i++) {
+                c = eeprom_read_byte(eepAddr+i);
                 if (c == 255 || c == 0) {
                     buf[i] = 0;
                     break;
@@ -1154,18 +1361,25 @@ Status JsonController::processEEPROMValue(JsonCommand& jcmd, JsonObject& jobj, c
             jobj[key] = buf;
         }
     } else {
-        int16_t len = strlen(buf) + 1;
-        if (len >= EEPROM_BYTES) {
+        // Print the value straight into EEPROM without a buffer, after a
+        // dry run that checks its length including the terminator
+        EEPROMPrint check(eepAddr, eepAddr + EEPROM_BYTES - 2, false);
+        if (isJson) {
+            jcmd.printValue(check, jvalue, NULL, this); // streams "eep!" groups
+        } else {
+            check.print(value);
+        }
+        if (check.addr > check.end) {
             return jcmd.setError(STATUS_JSON_EEPROM, key);
         }
-        for (int16_t i=0; i<len; i++) {
-            eeprom_write_byte((uint8_t*)addrLong+i, buf[i]);
-            TESTCOUT3("EEPROM[", ((int)addrLong+i), "]:",
-                      (char) eeprom_read_byte((uint8_t *) addrLong+i),
-                      " ",
-                      (int) eeprom_read_byte((uint8_t *) addrLong+i)
-                     );
+        EEPROMPrint out(eepAddr, check.end + 1, true);
+        if (isJson) {
+            jcmd.printValue(out, jvalue, NULL, this);
+        } else {
+            out.print(value);
         }
+        out.write(0);
+        TESTCOUT2("EEPROM[", addrLong, "] bytes:", (int)(out.addr - eepAddr));
     }
     return status;
 }
@@ -1185,8 +1399,10 @@ Status JsonController::initializeProbe(JsonCommand& jcmd, JsonObject& jobj,
             node["2"] = "";
             node["3"] = "";
             node["4"] = "";
+            node["fd"] = "";
             node["ip"] = "";
             node["pn"] = "";
+            node["rp"] = "";
             node["sd"] = "";
         }
         JsonObject& kidObj = jobj[key];
@@ -1201,12 +1417,17 @@ Status JsonController::initializeProbe(JsonCommand& jcmd, JsonObject& jobj,
                 return jcmd.setError(STATUS_FIELD_REQUIRED, "pn");
             }
         }
+    } else if (strcmp("prbfd", key) == 0 || strcmp("fd", key) == 0) {
+        status = processField<DelayMics, int32_t>(jobj, key, machine.op.probe.fastDelay);
     } else if (strcmp("prbip", key) == 0 || strcmp("ip", key) == 0) {
         status = processField<bool, bool>(jobj, key, machine.op.probe.invertProbe);
     } else if (strcmp("prbpn", key) == 0 || strcmp("pn", key) == 0) {
         status = processField<PinType, int32_t>(jobj, key, machine.op.probe.pinProbe);
+    } else if (strcmp("prbrp", key) == 0 || strcmp("rp", key) == 0) {
+        status = processField<StepCoord, int32_t>(jobj, key, machine.op.probe.retract);
     } else if (strcmp("prbsd", key) == 0 || strcmp("sd", key) == 0) {
         status = processField<DelayMics, int32_t>(jobj, key, machine.searchDelay);
+        machine.invalidateHash();
     } else {
         MotorIndex iMotor = machine.motorOfName(key + (strlen(key) - 1));
         if (iMotor == INDEX_NONE) {
@@ -1400,21 +1621,19 @@ Status JsonController::cancel(JsonCommand& jcmd, Status cause) {
 void JsonController::sendResponse(JsonCommand &jcmd, Status status) {
     jcmd.setStatus(status);
     if (status >= 0) {
-        if (jcmd.responseAvailable() < 1) {
-            TESTCOUT2("response available:", jcmd.responseAvailable(), " capacity:", jcmd.responseCapacity());
-            jcmd.setStatus(STATUS_JSON_MEM1);
-        } else if (jcmd.requestAvailable() < 1) {
+        if (jcmd.requestAvailable() < 1) {
             TESTCOUT2("request available:", jcmd.requestAvailable(), " capacity:", jcmd.requestCapacity());
             jcmd.setStatus(STATUS_JSON_MEM2);
         }
     }
-    if (machine.jsonPrettyPrint) {
-        jcmd.response().prettyPrintTo(Serial);
+    if (jcmd.isMsgPack()) {
+        jcmd.packResponse(Serial, this);
+        jcmd.responseClear();
     } else {
-        jcmd.response().printTo(Serial);
+        jcmd.printResponse(Serial, machine.jsonPrettyPrint, this);
+        jcmd.responseClear();
+        Serial.println();
     }
-    jcmd.responseClear();
-    Serial.println();
 }
 
 Status JsonController::processObj(JsonCommand& jcmd, JsonObject&jobj) {
@@ -1423,72 +1642,131 @@ Status JsonController::processObj(JsonCommand& jcmd, JsonObject&jobj) {
     Status status = STATUS_OK;
 
     for (JsonObject::iterator it = jobj.begin(); status >= 0 && it != jobj.end(); ++it) {
-        if (strcmp("dvs", it->key) == 0) {
-            status = processStroke(jcmd, jobj, it->key);
-        } else if (strncmp("mov", it->key, 3) == 0) {
-            status = PHMoveTo(machine).process(jcmd, jobj, it->key);
-        } else if (strncmp("hom", it->key, 3) == 0) {
-            status = processHome(jcmd, jobj, it->key);
-        } else if (strncmp("tst", it->key, 3) == 0) {
-            status = processTest(jcmd, jobj, it->key);
-        } else if (strncmp("sys", it->key, 3) == 0) {
-            status = processSys(jcmd, jobj, it->key);
-        } else if (strncmp("dpy", it->key, 3) == 0) {
-            status = processDisplay(jcmd, jobj, it->key);
-        } else if (strncmp("mpo", it->key, 3) == 0) {
+        const char *key = it->key;
+        bool exact = keyCode(key) != 0;
+        switch (keyPrefix(key)) {
+        case KEY_CODE('d','v','s'):
+            if (exact) {
+                status = processStroke(jcmd, jobj, key);
+            } else {
+                status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
+            }
+            break;
+        case KEY_CODE('m','o','v'):
+            status = PHMoveTo(machine).process(jcmd, jobj, key);
+            break;
+        case KEY_CODE('h','o','m'):
+            status = processHome(jcmd, jobj, key);
+            break;
+        case KEY_CODE('t','s','t'):
+            status = processTest(jcmd, jobj, key);
+            break;
+        case KEY_CODE('s','y','s'):
+            status = processSys(jcmd, jobj, key);
+            break;
+        case KEY_CODE('d','p','y'):
+            status = processDisplay(jcmd, jobj, key);
+            break;
+        case KEY_CODE('m','p','o'):
             switch (machine.topology) {
             case MTO_RAW:
             default:
-                status = processPosition(jcmd, jobj, it->key);
+                status = processPosition(jcmd, jobj, key);
                 break;
             case MTO_FPD:
-                status = processPosition_MTO_FPD(jcmd, jobj, it->key);
+                status = processPosition_MTO_FPD(jcmd, jobj, key);
                 break;
             }
-        } else if (strncmp("io", it->key, 2) == 0) {
-            status = processIO(jcmd, jobj, it->key);
-        } else if (strncmp("eep", it->key, 3) == 0) {
-            status = processEEPROM(jcmd, jobj, it->key);
-        } else if (strncmp("dim", it->key, 3) == 0) {
+            break;
+        case KEY_CODE('e','e','p'):
+            status = processEEPROM(jcmd, jobj, key);
+            break;
+        case KEY_CODE('d','i','m'):
             switch (machine.topology) {
             case MTO_RAW:
             default:
-                status = jcmd.setError(STATUS_TOPOLOGY_NAME, it->key);
+                status = jcmd.setError(STATUS_TOPOLOGY_NAME, key);
                 break;
             case MTO_FPD:
-                status = processDimension_MTO_FPD(jcmd, jobj, it->key);
+                status = processDimension_MTO_FPD(jcmd, jobj, key);
                 break;
             }
-        } else if (strncmp("prb", it->key, 3) == 0) {
+            break;
+        case KEY_CODE('z','m','p'):
             switch (machine.topology) {
             case MTO_RAW:
             default:
-                status = processProbe(jcmd, jobj, it->key);
+                status = jcmd.setError(STATUS_TOPOLOGY_NAME, key);
                 break;
             case MTO_FPD:
-                status = processProbe_MTO_FPD(jcmd, jobj, it->key);
+                status = processHeightMap_MTO_FPD(jcmd, jobj, key);
                 break;
             }
-		} else if (strcmp("idl", it->key) == 0) {
-			int16_t ms = it->value;
-			delay(ms);
-		} else if (strcmp("cmt", it->key) == 0) {
-			if (OUTPUT_CMT==(machine.outputMode&OUTPUT_CMT)) {
+            break;
+        case KEY_CODE('p','r','b'):
+            switch (machine.topology) {
+            case MTO_RAW:
+            default:
+                if (strcmp("prbg", key) == 0) {
+                    status = jcmd.setError(STATUS_TOPOLOGY_NAME, key);
+                } else {
+                    status = processProbe(jcmd, jobj, key);
+                }
+                break;
+            case MTO_FPD:
+                if (strcmp("prbg", key) == 0) {
+                    status = processProbeGrid_MTO_FPD(jcmd, jobj, key);
+                } else {
+                    status = processProbe_MTO_FPD(jcmd, jobj, key);
+                }
+                break;
+            }
+            break;
+		case KEY_CODE('i','d','l'):
+			if (exact) {
+				int16_t ms = it->value;
+				delay(ms);
+			} else {
+				status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
+			}
+			break;
+		case KEY_CODE('c','m','t'):
+			if (exact) {
+				if (OUTPUT_CMT==(machine.outputMode&OUTPUT_CMT)) {
+					const char *s = it->value;
+					Serial.println(s);
+				}
+				status = STATUS_OK;
+			} else {
+				status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
+			}
+			break;
+		case KEY_CODE('m','s','g'):
+			if (exact) {
 				const char *s = it->value;
 				Serial.println(s);
+				status = STATUS_OK;
+			} else {
+				status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
 			}
-			status = STATUS_OK;
-		} else if (strcmp("msg", it->key) == 0) {
-			const char *s = it->value;
-			Serial.println(s);
-			status = STATUS_OK;
-        } else {
-            switch (it->key[0]) {
+			break;
+        case KEY_CODE('i','d',0):
+            // host request id: echoed with the request in the response
+            break;
+        default:
+            switch (key[0]) {
+            case 'i':
+                if (key[1] == 'o') {
+                    status = processIO(jcmd, jobj, key);
+                } else {
+                    status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
+                }
+                break;
             case '1':
             case '2':
             case '3':
             case '4':
-                status = processMotor(jcmd, jobj, it->key, it->key[0]);
+                status = processMotor(jcmd, jobj, key, key[0]);
                 break;
             case 'x':
             case 'y':
@@ -1496,12 +1774,13 @@ Status JsonController::processObj(JsonCommand& jcmd, JsonObject&jobj) {
             case 'a':
             case 'b':
             case 'c':
-                status = processAxis(jcmd, jobj, it->key, it->key[0]);
+                status = processAxis(jcmd, jobj, key, key[0]);
                 break;
             default:
-                status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, it->key);
+                status = jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
                 break;
             }
+            break;
         }
     }
 
@@ -1519,7 +1798,7 @@ Status JsonController::process(JsonCommand& jcmd) {
         JsonArray& jarr = jroot;
         if (jcmd.cmdIndex < jarr.size()) {
             JsonObject& jobj = jarr[jcmd.cmdIndex];
-            jcmd.jResponseRoot["r"] = jobj;
+            jcmd.jResponse = jobj;
             status = processObj(jcmd, jobj);
             //TESTCOUT3("JsonController::process(", (int) jcmd.cmdIndex+1,
             //" of ", jarr.size(), ") status:", status);
@@ -1643,8 +1922,10 @@ Status JsonController::initializeProbe_MTO_FPD(JsonCommand& jcmd, JsonObject& jo
             node["2"] = "";
             node["3"] = "";
             node["4"] = "";
+            node["fd"] = "";
             node["ip"] = "";
             node["pn"] = machine.op.probe.pinProbe;
+            node["rp"] = "";
             node["sd"] = "";
             node["x"] = xyzEnd.x;
             node["y"] = xyzEnd.y;
@@ -1662,12 +1943,17 @@ Status JsonController::initializeProbe_MTO_FPD(JsonCommand& jcmd, JsonObject& jo
                 return jcmd.setError(STATUS_FIELD_REQUIRED, "pn");
             }
         }
+    } else if (strcmp("prbfd", key) == 0 || strcmp("fd", key) == 0) {
+        status = processField<DelayMics, int32_t>(jobj, key, machine.op.probe.fastDelay);
     } else if (strcmp("prbip", key) == 0 || strcmp("ip", key) == 0) {
         status = processField<bool, bool>(jobj, key, machine.op.probe.invertProbe);
     } else if (strcmp("prbpn", key) == 0 || strcmp("pn", key) == 0) {
         status = processField<PinType, int32_t>(jobj, key, machine.op.probe.pinProbe);
+    } else if (strcmp("prbrp", key) == 0 || strcmp("rp", key) == 0) {
+        status = processField<StepCoord, int32_t>(jobj, key, machine.op.probe.retract);
     } else if (strcmp("prbsd", key) == 0 || strcmp("sd", key) == 0) {
         status = processField<DelayMics, int32_t>(jobj, key, machine.searchDelay);
+        machine.invalidateHash();
     } else if (strcmp("prbx", key) == 0 || strcmp("x", key) == 0) {
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, xyzEnd.x);
     } else if (strcmp("prby", key) == 0 || strcmp("y", key) == 0) {
@@ -1754,23 +2040,238 @@ Status JsonController::processProbe_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj,
     return status;
 }
 
+Status JsonController::initializeProbeGrid_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj,
+        const char* key)
+{
+    Status status = STATUS_OK;
+    OpProbeGrid &grid = machine.op.grid;
+    const char *s;
+    if (strcmp("prbg", key) == 0) {
+        XYZ3D xyz = machine.getXYZ3D();
+        if (!xyz.isValid()) {
+            return jcmd.setError(STATUS_KINEMATIC_XYZ, key);
+        }
+        grid.setup();
+        grid.x = xyz.x;
+        grid.y = xyz.y;
+        grid.zEnd = machine.delta.getMinZ();
+        if ((s = jobj[key]) && *s == 0) {
+            JsonObject& node = jobj.createNestedObject(key);
+            node["dx"] = "";
+            node["dy"] = "";
+            node["fd"] = "";
+            node["ip"] = "";
+            node["nx"] = "";
+            node["ny"] = "";
+            node["pn"] = machine.op.probe.pinProbe;
+            node["rp"] = "";
+            node["sd"] = "";
+            node["x"] = "";
+            node["y"] = "";
+            node["z"] = "";
+            node["zh"] = "";
+        }
+        JsonObject& kidObj = jobj[key];
+        if (!kidObj.success()) {
+            return jcmd.setError(STATUS_JSON_OBJECT, key);
+        }
+        for (JsonObject::iterator it = kidObj.begin(); it != kidObj.end(); ++it) {
+            status = initializeProbeGrid_MTO_FPD(jcmd, kidObj, it->key);
+            if (status < 0) {
+                return jcmd.setError(status, it->key);
+            }
+        }
+        if (machine.op.probe.pinProbe == NOPIN) {
+            return jcmd.setError(STATUS_FIELD_REQUIRED, "pn");
+        }
+        HeightMap &map = machine.heightMap;
+        map.enabled = false; // probe the uncompensated surface
+        if (grid.size() <= HEIGHT_MAP_POINTS) {
+            map.clear();
+            map.x = grid.x;
+            map.y = grid.y;
+            map.dx = grid.dx;
+            map.dy = grid.dy;
+            map.nx = grid.nx;
+            map.ny = grid.ny;
+        }
+        return STATUS_BUSY_CALIBRATING;
+    }
+    switch (keyCode(key)) {
+    case KEY_CODE('d','x',0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.dx);
+        break;
+    case KEY_CODE('d','y',0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.dy);
+        break;
+    case KEY_CODE('f','d',0):
+        status = processField<DelayMics, int32_t>(jobj, key, grid.fastDelay);
+        break;
+    case KEY_CODE('i','p',0):
+        status = processField<bool, bool>(jobj, key, machine.op.probe.invertProbe);
+        break;
+    case KEY_CODE('n','x',0):
+        status = processField<uint8_t, int32_t>(jobj, key, grid.nx);
+        if (grid.nx == 0) {
+            status = STATUS_VALUE_RANGE;
+        }
+        break;
+    case KEY_CODE('n','y',0):
+        status = processField<uint8_t, int32_t>(jobj, key, grid.ny);
+        if (grid.ny == 0) {
+            status = STATUS_VALUE_RANGE;
+        }
+        break;
+    case KEY_CODE('p','n',0):
+        status = processField<PinType, int32_t>(jobj, key, machine.op.probe.pinProbe);
+        break;
+    case KEY_CODE('r','p',0):
+        status = processField<StepCoord, int32_t>(jobj, key, grid.retract);
+        break;
+    case KEY_CODE('s','d',0):
+        status = processField<DelayMics, int32_t>(jobj, key, machine.searchDelay);
+        machine.invalidateHash();
+        break;
+    case KEY_CODE('x',0,0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.x);
+        break;
+    case KEY_CODE('y',0,0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.y);
+        break;
+    case KEY_CODE('z',0,0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.zEnd);
+        break;
+    case KEY_CODE('z','h',0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, grid.zHop);
+        if (grid.zHop <= 0) {
+            status = STATUS_VALUE_RANGE;
+        }
+        break;
+    default:
+        return STATUS_UNRECOGNIZED_NAME;
+    }
+    return status;
+}
+
+/**
+ * Grid probe. Each pass either rises vertically to zh above the previous
+ * contact, travels level to the next point, or continues probing down to z.
+ * Contact heights stream out as {"prbg":{"r":row,"c":column,"z":[...]}}
+ * lines of up to PROBE_GRID_CHUNK points in increasing column order.
+ * Grids that fit also replace the height map, relative to the first point,
+ * and leave it disabled.
+ */
+Status JsonController::processProbeGrid_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key) {
+    Status status = jcmd.getStatus();
+    OpProbeGrid &grid = machine.op.grid;
+    switch (status) {
+    case STATUS_BUSY_PARSED:
+        return initializeProbeGrid_MTO_FPD(jcmd, jobj, key);
+    case STATUS_BUSY_OK:
+    case STATUS_BUSY_CALIBRATING:
+        break;
+    default:
+        ASSERT(false);
+        return jcmd.setError(STATUS_STATE, key);
+    }
+
+    if (grid.travelling) {
+        XYZ3D xyz = machine.getXYZ3D();
+        Quad<PH5TYPE> dest;
+        dest.value[0] = xyz.x;
+        dest.value[1] = xyz.y;
+        dest.value[2] = xyz.z;
+        dest.value[3] = machine.getMotorAxis(3).position;
+        if (grid.lifting) { // clear the surface before moving sideways
+            dest.value[2] = grid.zContact + grid.zHop;
+            status = PHMoveTo(machine).moveTo(jcmd, dest);
+            if (status != STATUS_OK) {
+                return status;
+            }
+            grid.lifting = false;
+            return grid.index < grid.size() ? STATUS_BUSY_CALIBRATING : STATUS_OK;
+        }
+        dest.value[0] = grid.pointX(grid.index);
+        dest.value[1] = grid.pointY(grid.index);
+        status = PHMoveTo(machine).moveTo(jcmd, dest);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        PH5TYPE zEnd = max(grid.zEnd, machine.delta.getMinZ(dest.value[0], dest.value[1]));
+        Step3D pEnd = machine.delta.calcPulses(XYZ3D(dest.value[0], dest.value[1], zEnd));
+        if (!pEnd.isValid()) {
+            return jcmd.setError(STATUS_KINEMATIC_XYZ, key);
+        }
+        Quad<StepCoord> posStart = machine.getMotorPosition();
+        Quad<StepCoord> posEnd(pEnd.p1, pEnd.p2, pEnd.p3, posStart.value[3]);
+        machine.op.probe.setup(posStart, posEnd);
+        machine.op.probe.dataSource = PDS_Z;
+        machine.op.probe.fastDelay = grid.fastDelay;
+        machine.op.probe.retract = grid.retract;
+        grid.travelling = false;
+        return STATUS_BUSY_CALIBRATING;
+    }
+
+    status = machine.probe(status);
+    if (status == STATUS_OK) {
+        grid.zContact = machine.op.probe.probeData[0];
+        grid.chunk[grid.chunkLen++] = grid.zContact;
+        if (grid.index == 0) {
+            grid.zFirst = grid.zContact;
+        }
+        if (grid.size() <= HEIGHT_MAP_POINTS) {
+            PH5TYPE microns = (grid.zContact - grid.zFirst) * 1000;
+            uint16_t i = grid.row(grid.index) * grid.nx + grid.column(grid.index);
+            machine.heightMap.z[i] = (int16_t)(microns < 0 ? microns - 0.5 : microns + 0.5);
+        }
+        grid.index++;
+        if (grid.chunkLen == PROBE_GRID_CHUNK || grid.index % grid.nx == 0) {
+            sendProbeGrid(jcmd);
+        }
+        grid.travelling = true;
+        grid.lifting = true;
+        status = STATUS_BUSY_CALIBRATING;
+    } else if (status < 0) {
+        sendProbeGrid(jcmd); // report points probed before the failure
+    }
+    return status;
+}
+
+void JsonController::sendProbeGrid(JsonCommand& jcmd) {
+    OpProbeGrid &grid = machine.op.grid;
+    if (grid.chunkLen == 0) {
+        return;
+    }
+    uint16_t iFirst = grid.index - grid.chunkLen;
+    uint16_t iLast = grid.index - 1;
+    bool reverse = grid.row(iLast) & 1;
+    StaticJsonBuffer<JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(PROBE_GRID_CHUNK)> jb;
+    JsonObject& root = jb.createObject();
+    JsonObject& node = root.createNestedObject("prbg");
+    node["r"] = grid.row(iLast);
+    node["c"] = grid.column(reverse ? iLast : iFirst);
+    JsonArray& jz = node.createNestedArray("z");
+    for (uint8_t i = 0; i < grid.chunkLen; i++) {
+        jz.add(grid.chunk[reverse ? grid.chunkLen - 1 - i : i], 3);
+    }
+    if (jcmd.isMsgPack()) {
+        JsonVariant jroot;
+        jroot = root;
+        msgpackWriteVariant(Serial, jroot);
+    } else {
+        root.printTo(Serial);
+        Serial.println();
+    }
+    grid.chunkLen = 0;
+}
+
 Status JsonController::processDimension_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key) {
     Status status = STATUS_OK;
+    const char *s;
+    bool isAssignment = (!(s = jobj[key]) || *s != 0);
     if (strcmp("dim", key) == 0) {
-        const char *s;
         if ((s = jobj[key]) && *s == 0) {
-            JsonObject& node = jobj.createNestedObject(key);
-            node["e"] = "";
-            node["f"] = "";
-            node["gr"] = "";
-            node["ha1"] = "";
-            node["ha2"] = "";
-            node["ha3"] = "";
-            node["mi"] = "";
-            node["pd"] = "";
-            node["re"] = "";
-            node["rf"] = "";
-            node["st"] = "";
+            return queryGroup(jcmd, jobj, key);
         }
         JsonObject& kidObj = jobj[key];
         if (kidObj.success()) {
@@ -1781,36 +2282,52 @@ Status JsonController::processDimension_MTO_FPD(JsonCommand& jcmd, JsonObject& j
                 }
             }
         }
-    } else if (strcmp("e", key) == 0 || strcmp("dime", key) == 0) {
+        return status;
+    }
+    switch (keyCode(strncmp("dim", key, 3) == 0 ? key + 3 : key)) {
+    case KEY_CODE('e',0,0): {
         PH5TYPE value = machine.delta.getEffectorTriangleSide();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, value);
         machine.delta.setEffectorTriangleSide(value);
-    } else if (strcmp("f", key) == 0 || strcmp("dimf", key) == 0) {
+        break;
+    }
+    case KEY_CODE('f',0,0): {
         PH5TYPE value = machine.delta.getBaseTriangleSide();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, value);
         machine.delta.setBaseTriangleSide(value);
-    } else if (strcmp("gr", key) == 0 || strcmp("dimgr", key) == 0) {
+        break;
+    }
+    case KEY_CODE('g','r',0): {
         PH5TYPE value = machine.delta.getGearRatio();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, value);
         machine.delta.setGearRatio(value);
-    } else if (strcmp("ha1", key) == 0 || strcmp("dimha1", key) == 0) {
+        break;
+    }
+    case KEY_CODE('h','a','1'): {
         Angle3D homeAngles = machine.delta.getHomeAngles();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, homeAngles.theta1);
         machine.delta.setHomeAngles(homeAngles);
-    } else if (strcmp("ha2", key) == 0 || strcmp("dimha2", key) == 0) {
+        break;
+    }
+    case KEY_CODE('h','a','2'): {
         Angle3D homeAngles = machine.delta.getHomeAngles();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, homeAngles.theta2);
         machine.delta.setHomeAngles(homeAngles);
-    } else if (strcmp("ha3", key) == 0 || strcmp("dimha3", key) == 0) {
+        break;
+    }
+    case KEY_CODE('h','a','3'): {
         Angle3D homeAngles = machine.delta.getHomeAngles();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, homeAngles.theta3);
         machine.delta.setHomeAngles(homeAngles);
-    } else if (strcmp("mi", key) == 0 || strcmp("dimmi", key) == 0) {
+        break;
+    }
+    case KEY_CODE('m','i',0): {
         int16_t value = machine.delta.getMicrosteps();
         status = processField<int16_t, int16_t>(jobj, key, value);
         machine.delta.setMicrosteps(value);
-    } else if (strcmp("pd", key) == 0 || strcmp("dimpd", key) == 0) {
-        const char *s;
+        break;
+    }
+    case KEY_CODE('p','d',0): {
         if ((s = jobj[key]) && *s == 0) {
             JsonArray &jarr = jobj.createNestedArray(key);
             for (int16_t i=0; i<PROBE_DATA; i++) {
@@ -1819,21 +2336,122 @@ Status JsonController::processDimension_MTO_FPD(JsonCommand& jcmd, JsonObject& j
         } else {
             status = jcmd.setError(STATUS_OUTPUT_FIELD, key);
         }
-    } else if (strcmp("re", key) == 0 || strcmp("dimre", key) == 0) {
+        break;
+    }
+    case KEY_CODE('r','e',0): {
         PH5TYPE value = machine.delta.getEffectorLength();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, value);
         machine.delta.setEffectorLength(value);
-    } else if (strcmp("rf", key) == 0 || strcmp("dimrf", key) == 0) {
+        break;
+    }
+    case KEY_CODE('r','f',0): {
         PH5TYPE value = machine.delta.getBaseArmLength();
         status = processField<PH5TYPE, PH5TYPE>(jobj, key, value);
         machine.delta.setBaseArmLength(value);
-    } else if (strcmp("st", key) == 0 || strcmp("dimst", key) == 0) {
+        break;
+    }
+    case KEY_CODE('s','t',0): {
         int16_t value = machine.delta.getSteps360();
         status = processField<int16_t, int16_t>(jobj, key, value);
         machine.delta.setSteps360(value);
-    } else {
+        break;
+    }
+    default:
         return jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
     }
+    if (isAssignment) {
+        machine.invalidateHash();
+    }
+    return status;
+}
+
+Status JsonController::processHeightMap_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key) {
+    Status status = STATUS_OK;
+    HeightMap &map = machine.heightMap;
+    const char *s;
+    if (strcmp("zmp", key) == 0) {
+        if ((s = jobj[key]) && *s == 0) {
+            JsonObject& node = jobj.createNestedObject(key);
+            node["dx"] = "";
+            node["dy"] = "";
+            node["nx"] = "";
+            node["ny"] = "";
+            node["on"] = "";
+            node["x"] = "";
+            node["y"] = "";
+            node["z"] = "";
+        }
+        JsonObject& kidObj = jobj[key];
+        if (!kidObj.success()) {
+            return jcmd.setError(STATUS_JSON_OBJECT, key);
+        }
+        for (JsonObject::iterator it = kidObj.begin(); it != kidObj.end(); ++it) {
+            status = processHeightMap_MTO_FPD(jcmd, kidObj, it->key);
+            if (status != STATUS_OK) {
+                return status;
+            }
+        }
+        if ((uint16_t) map.nx * map.ny > HEIGHT_MAP_POINTS) {
+            map.nx = map.ny = 0;
+            map.enabled = false;
+            return jcmd.setError(STATUS_VALUE_RANGE, key);
+        }
+        return status;
+    }
+    bool isGroupKey = strncmp("zmp", key, 3) == 0; // e.g., "zmpnx"
+    switch (keyCode(isGroupKey ? key + 3 : key)) {
+    case KEY_CODE('d','x',0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, map.dx);
+        break;
+    case KEY_CODE('d','y',0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, map.dy);
+        break;
+    case KEY_CODE('n','x',0):
+        status = processField<uint8_t, int32_t>(jobj, key, map.nx);
+        break;
+    case KEY_CODE('n','y',0):
+        status = processField<uint8_t, int32_t>(jobj, key, map.ny);
+        break;
+    case KEY_CODE('o','n',0):
+        status = processField<bool, bool>(jobj, key, map.enabled);
+        break;
+    case KEY_CODE('x',0,0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, map.x);
+        break;
+    case KEY_CODE('y',0,0):
+        status = processField<PH5TYPE, PH5TYPE>(jobj, key, map.y);
+        break;
+    case KEY_CODE('z',0,0): {
+        uint16_t n = min((uint16_t)(map.nx * map.ny), (uint16_t) HEIGHT_MAP_POINTS);
+        if ((s = jobj[key]) && *s == 0) {
+            JsonArray &jarr = jobj.createNestedArray(key);
+            for (uint16_t i = 0; i < n; i++) {
+                jarr.add(map.z[i] / (PH5TYPE) 1000, 3);
+            }
+        } else {
+            JsonArray &jarr = jobj[key];
+            if (!jarr.success()) {
+                return jcmd.setError(STATUS_FIELD_ARRAY_ERROR, key);
+            }
+            for (uint16_t i = 0; i < HEIGHT_MAP_POINTS && jarr[i].success(); i++) {
+                PH5TYPE mm = jarr[i];
+                if (mm < -32 || 32 < mm) {
+                    return jcmd.setError(STATUS_VALUE_RANGE, key);
+                }
+                map.z[i] = (int16_t)(mm < 0 ? mm * 1000 - 0.5 : mm * 1000 + 0.5);
+            }
+        }
+        break;
+    }
+    default:
+        return jcmd.setError(STATUS_UNRECOGNIZED_NAME, key);
+    }
+    if (status == STATUS_OK && isGroupKey &&
+            (uint16_t) map.nx * map.ny > HEIGHT_MAP_POINTS) {
+        map.nx = map.ny = 0;
+        map.enabled = false;
+        return jcmd.setError(STATUS_VALUE_RANGE, key);
+    }
     return status;
 }
 
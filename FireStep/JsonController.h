@@ -11,7 +11,7 @@
 
 namespace firestep {
 
-typedef class JsonController {
+typedef class JsonController : public JsonStreamer {
 private:
     Status initializeStrokeArray(JsonCommand &jcmd, JsonObject& stroke,
                                  const char *key, MotorIndex iMotor, int16_t &slen);
@@ -47,6 +47,12 @@ protected:
     Status processPosition_MTO_FPD(JsonCommand &jcmd, JsonObject& jobj, const char* key);
     Status finalizeProbe_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key);
     Status processDimension_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key);
+    Status processHeightMap_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key);
+    Status initializeProbeGrid_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key);
+    Status processProbeGrid_MTO_FPD(JsonCommand& jcmd, JsonObject& jobj, const char* key);
+    void sendProbeGrid(JsonCommand& jcmd);
+    Status processGroupField(JsonCommand &jcmd, JsonObject &kid, const char *field, const char *key);
+    Status queryGroup(JsonCommand &jcmd, JsonObject &jobj, const char *key);
 
 public:
     JsonController(Machine& machine);
@@ -54,6 +60,7 @@ public:
     Status setup();
     Status process(JsonCommand& jcmd);
     Status cancel(JsonCommand &jcmd, Status cause);
+    void streamGroup(JsonCommand &jcmd, Print &out, const char *key, bool pack);
 } JsonController;
 
 } // namespace firestep
@@ -13,6 +13,7 @@
 #define TESTCOUT4(k1,v1,k2,v2,k3,v3,k4,v4) cout << k1<<v1 <<k2<<v2 <<k3<<v3 <<k4<<v4 << endl
 #define TESTDECL(t,v) t v
 #define TESTEXP(e) e
+#define MCU_LOCAL thread_local // each host thread simulates its own MCU
 #else
 #define TESTCOUT1(k,v)
 #define TESTCOUT2(k1,v1,k2,v2)
@@ -20,6 +21,7 @@
 #define TESTCOUT4(k1,v1,k2,v2,k3,v3,k4,v4)
 #define TESTDECL(t,v)
 #define TESTEXP(e)
+#define MCU_LOCAL
 #endif
 
 #define DEBUG_EOL() Serial.println("");
@@ -32,8 +34,6 @@
 #define MS_CYCLES(ms) FREQ_CYCLES(1000.0 / (ms))
 #define MS_TICKS_REAL(ms) (FREQ_CYCLES(1000.0 / (ms))/TIMER_PRESCALE)
 #define MS_TICKS(ms) ((int32_t) MS_TICKS_REAL(ms))
-#define MAX_GENERATIONS 50010
-#define GENERATION_RESET 50000
 #define TIMER_ENABLED (TCCR1B & (1<<CS12 || 1<<CS11 || 1<<CS10))
 #define TICK_MICROSECONDS ((TIMER_PRESCALE * 1000L)/(CLOCK_HZ/1000))
 #define TICKS_PER_SECOND ((int32_t)MS_TICKS(1000))
@@ -98,6 +98,10 @@ inline void pulseFast(uint8_t pin) {
 
     SREG = oldSREG;
 }
+#elif defined(TEST)
+inline void pulseFast(uint8_t pin) {
+    arduino.pulseFast(pin); // modeled on the AVR version above
+}
 #else
 inline void pulseFast(uint8_t pin) {
     digitalWrite(pin, HIGH);
@@ -119,9 +123,24 @@ inline int16_t freeRam () {
 #define EEPROM_BYTES 512 /* Actual capacity will be less because eeprom buffer is part of MAX_JSON */
 #define EEPROM_END 4096
 
+/**
+ * CRC-16 (polynomial 0xA001) as in avr-libc _crc16_update()
+ */
+inline uint16_t crc16_update(uint16_t crc, uint8_t a) {
+    crc ^= a;
+    for (uint8_t i = 0; i < 8; ++i) {
+        crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+    return crc;
+}
+
 #ifdef TEST
 extern uint8_t eeprom_read_byte(uint8_t *addr);
 extern void eeprom_write_byte(uint8_t *addr, uint8_t value);
+extern void eeprom_update_byte(uint8_t *addr, uint8_t value);
+extern MCU_LOCAL int32_t eeprom_write_count;
+extern void eeprom_read_block(void *dst, const void *src, size_t n);
+extern void eeprom_update_block(const void *src, void *dst, size_t n);
 string eeprom_read_string(uint8_t *addr);
 #endif
 
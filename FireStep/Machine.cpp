@@ -13,7 +13,7 @@ using namespace firestep;
 template class Quad<int16_t>;
 template class Quad<int32_t>;
 
-TESTDECL(int32_t, firestep::delayMicsTotal = 0);
+TESTDECL(MCU_LOCAL int32_t, firestep::delayMicsTotal = 0);
 
 /////////// Silly things done without snprintf (ARDUINO!!!!) /////////////
 char * firestep::saveConfigValue(const char *key, const char *value, char *out) {
@@ -83,7 +83,10 @@ Status Axis::enable(bool active) {
     }
     digitalWrite(pinEnable, active ? PIN_ENABLE : PIN_DISABLE);
     setAdvancing(true);
-    enabled = active;
+    if (enabled != active) {
+        enabled = active;
+        hashDirty = true;
+    }
     return STATUS_OK;
 }
 
@@ -124,13 +127,43 @@ char * Axis::saveConfig(char *out, size_t maxLen) {
     return out;
 }
 
+void Axis::saveConfig(AxisConfig &cfg) {
+    cfg.home = home;
+    cfg.travelMin = travelMin;
+    cfg.travelMax = travelMax;
+    cfg.usDelay = usDelay;
+    cfg.idleSnooze = idleSnooze;
+    cfg.stepAngle = stepAngle;
+    cfg.microsteps = microsteps;
+    cfg.dirHIGH = dirHIGH;
+    cfg.enabled = enabled;
+}
+
+void Axis::loadConfig(const AxisConfig &cfg) {
+    home = cfg.home;
+    travelMin = cfg.travelMin;
+    travelMax = cfg.travelMax;
+    usDelay = cfg.usDelay;
+    idleSnooze = cfg.idleSnooze;
+    stepAngle = cfg.stepAngle;
+    microsteps = cfg.microsteps < 1 ? 1 : cfg.microsteps;
+    dirHIGH = cfg.dirHIGH;
+    if (pinDir != NOPIN) { // force setting of direction bit in case meaning changed
+        setAdvancing(false);
+        setAdvancing(true);
+    }
+    enable(cfg.enabled);
+    hashDirty = true;
+}
+
 ////////////////////// Machine /////////////////////////
 
 Machine::Machine()
     : autoHome(false),invertLim(false), pDisplay(&nullDisplay), jsonPrettyPrint(false), vMax(12800),
       tvMax(0.7), homingPulses(3), latchBackoff(LATCH_BACKOFF),
       searchDelay(800), pinStatus(NOPIN), topology(MTO_RAW),
-      outputMode(OUTPUT_ARRAY1), debounce(0), autoSync(false), syncHash(0)
+      outputMode(OUTPUT_ARRAY1), debounce(0), autoSync(false), syncHash(0),
+      hashCache(0), hashDirty(true)
 {
     pinEnableHigh = false;
     for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
@@ -154,7 +187,27 @@ void Machine::setup(PinConfig cfg) {
 	}
 }
 
+/**
+ * Return the configuration hash, recomputing it only if the
+ * configuration has been invalidated since the last call.
+ * Code that changes configuration outside of Axis::enable()
+ * must call invalidateHash().
+ */
 int32_t Machine::hash() {
+    for (AxisIndex i=0; i<AXIS_COUNT; i++) {
+        if (axis[i].hashDirty) {
+            axis[i].hashDirty = false;
+            hashDirty = true;
+        }
+    }
+    if (hashDirty) {
+        hashCache = calcHash();
+        hashDirty = false;
+    }
+    return hashCache;
+}
+
+int32_t Machine::calcHash() {
 	int32_t result = 0
 		^ ((uint32_t) outputMode << 8)
 		^ ((uint32_t) topology << 9)
@@ -312,6 +365,7 @@ Status Machine::setPinConfig(PinConfig pc) {
         axis[i].enable(enabled[i]);
     }
     pDisplay->setup(pinStatus);
+    invalidateHash();
 
     return status;
 }
@@ -587,6 +641,7 @@ Status Machine::home(Status status) {
                 a.homing = false;
             }
         }
+        mapOffset = Quad<StepCoord>();
         status = finalizeHome();
         break;
     }
@@ -605,11 +660,10 @@ Status Machine::probe(Status status, DelayMics delay) {
         }
     }
 
-    op.probe.probing = !isAtLimit(op.probe.pinProbe);
-    if (op.probe.invertProbe) {
-        op.probe.probing = !op.probe.probing;
-    }
-    if (op.probe.probing) {
+    op.probe.probing = !probeContact();
+    if (op.probe.fastDelay > 0 && (op.probe.probing || op.probe.curDelta > 0)) {
+        status = probeFast(delay < 0 ? searchDelay : delay);
+    } else if (op.probe.probing) {
         status = stepProbe(delay < 0 ? searchDelay : delay);
     } else {
         if (topology == MTO_FPD && op.probe.dataSource == PDS_Z) {
@@ -622,14 +676,67 @@ Status Machine::probe(Status status, DelayMics delay) {
     return status;
 }
 
-Status Machine::stepProbe(int16_t delay) {
+bool Machine::probeContact() {
+    bool contact = isAtLimit(op.probe.pinProbe);
+    return op.probe.invertProbe ? !contact : contact;
+}
+
+/**
+ * Two-phase probe: approach at fastDelay until contact, retract along the
+ * probe path and re-probe at the search delay. Each pass emits at most
+ * PROBE_FAST_PULSES pulses, so that the controller can still cancel.
+ */
+Status Machine::probeFast(int16_t delay) {
     Status status = STATUS_BUSY_CALIBRATING;
-    //StepCoord dMax = 0;
+    for (int16_t pulses = 0; pulses < PROBE_FAST_PULSES; ) {
+        switch (op.probe.phase) {
+        case PROBE_APPROACH:
+            if (probeContact()) {
+                StepCoord retract = op.probe.retract > 0 ? op.probe.retract : latchBackoff;
+                op.probe.retractDelta = max((StepCoord) 0, (StepCoord)(op.probe.curDelta - retract));
+                op.probe.phase = PROBE_RETRACT;
+                continue;
+            }
+            status = stepProbe(op.probe.fastDelay);
+            break;
+        case PROBE_RETRACT:
+            if (op.probe.curDelta <= op.probe.retractDelta) {
+                op.probe.phase = PROBE_SEARCH;
+                continue;
+            }
+            status = stepProbeTo(op.probe.curDelta - 1, op.probe.fastDelay);
+            break;
+        case PROBE_SEARCH:
+        default:
+            if (probeContact()) {
+                op.probe.fastDelay = 0; // probe() reports the contact
+                return STATUS_BUSY_CALIBRATING;
+            }
+            status = stepProbe(delay);
+            break;
+        }
+        if (status < 0) {
+            return status;
+        }
+        pulses++;
+    }
+    return status;
+}
 
+Status Machine::stepProbe(int16_t delay) {
     if (op.probe.curDelta >= op.probe.maxDelta) {
         return STATUS_PROBE_FAILED; // done
     }
-    op.probe.curDelta++;
+    return stepProbeTo(op.probe.curDelta + 1, delay);
+}
+
+/**
+ * Move at most one pulse per motor to the probe path point at delta
+ */
+Status Machine::stepProbeTo(StepCoord delta, int16_t delay) {
+    Status status = STATUS_BUSY_CALIBRATING;
+
+    op.probe.curDelta = delta;
     Quad<StepDV> pulse;
     for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
         StepCoord dp = op.probe.interpolate(i) - getMotorAxis(i).position;
@@ -725,8 +832,12 @@ void Machine::setMotorPosition(const Quad<StepCoord> &position) {
     for (MotorIndex i = 0; i < QUAD_ELEMENTS; i++) {
         motorAxis[i]->position = position.value[i];
     }
+    mapOffset = Quad<StepCoord>();
 }
 
+/**
+ * Nominal position. MTO_FPD excludes height map compensation.
+ */
 XYZ3D Machine::getXYZ3D() {
     switch (topology) {
     case MTO_RAW:
@@ -738,13 +849,114 @@ XYZ3D Machine::getXYZ3D() {
                );
     case MTO_FPD:
         return delta.calcXYZ(Step3D(
-                                 motorAxis[0]->position,
-                                 motorAxis[1]->position,
-                                 motorAxis[2]->position
+                                 motorAxis[0]->position - mapOffset.value[0],
+                                 motorAxis[1]->position - mapOffset.value[1],
+                                 motorAxis[2]->position - mapOffset.value[2]
                              ));
     }
 }
 
+/**
+ * Attach height map compensation to the stroke just built for the nominal
+ * motor offset dPos. Compensation is linearized over the stroke: XY and the
+ * pulses per Z millimeter are interpolated between the stroke endpoints, so
+ * each segment boundary costs one bilinear lookup. A disabled map still
+ * attaches while mapOffset is non-zero, so that the stroke removes it.
+ */
+void Machine::beginMapStroke(Quad<StepCoord> dPos) {
+    stroke.pOffset = NULL;
+    if (topology != MTO_FPD || (!heightMap.enabled && mapOffset.isZero())) {
+        return;
+    }
+    Quad<StepCoord> pos0 = getMotorPosition() - mapOffset;
+    Quad<StepCoord> pos1 = pos0 + dPos;
+    mapStroke.xyz0 = delta.calcXYZ(Step3D(pos0.value[0], pos0.value[1], pos0.value[2]));
+    mapStroke.xyz1 = delta.calcXYZ(Step3D(pos1.value[0], pos1.value[1], pos1.value[2]));
+    Step3D up0 = delta.calcPulses(XYZ3D(mapStroke.xyz0.x, mapStroke.xyz0.y, mapStroke.xyz0.z + 1));
+    Step3D up1 = delta.calcPulses(XYZ3D(mapStroke.xyz1.x, mapStroke.xyz1.y, mapStroke.xyz1.z + 1));
+    if (!mapStroke.xyz0.isValid() || !mapStroke.xyz1.isValid() ||
+            !up0.isValid() || !up1.isValid()) {
+        return; // no compensation outside the delta workspace
+    }
+    mapStroke.dpdz0[0] = up0.p1 - pos0.value[0];
+    mapStroke.dpdz0[1] = up0.p2 - pos0.value[1];
+    mapStroke.dpdz0[2] = up0.p3 - pos0.value[2];
+    mapStroke.dpdz1[0] = up1.p1 - pos1.value[0];
+    mapStroke.dpdz1[1] = up1.p2 - pos1.value[1];
+    mapStroke.dpdz1[2] = up1.p3 - pos1.value[2];
+    mapStroke.iMax = 0;
+    for (QuadIndex i = 1; i < 3; i++) {
+        if (abs(dPos.value[i]) > abs(dPos.value[mapStroke.iMax])) {
+            mapStroke.iMax = i;
+        }
+    }
+    mapStroke.dMax = dPos.value[mapStroke.iMax];
+    stroke.pOffset = this;
+}
+
+/**
+ * Record the compensation left in the motor positions by the last stroke
+ */
+void Machine::endMapStroke() {
+    if (stroke.pOffset) {
+        mapOffset += stroke.offset;
+        stroke.pOffset = NULL;
+    }
+}
+
+/**
+ * Motor offset that brings the compensation at the current nominal position
+ * up to date with the height map, e.g., after the map is changed or disabled
+ */
+Quad<StepCoord> Machine::mapCorrection() {
+    Quad<StepCoord> dMap;
+    beginMapStroke(Quad<StepCoord>());
+    if (stroke.pOffset) {
+        dMap = strokeOffset(Quad<StepCoord>());
+        stroke.pOffset = NULL;
+    }
+    return dMap;
+}
+
+Quad<StepCoord> Machine::strokeOffset(const Quad<StepCoord> &dPos) {
+    PH5TYPE f = mapStroke.dMax ? dPos.value[mapStroke.iMax] / (PH5TYPE) mapStroke.dMax : 1;
+    PH5TYPE h = 0;
+    if (heightMap.enabled) {
+        h = heightMap.height(
+                mapStroke.xyz0.x + f * (mapStroke.xyz1.x - mapStroke.xyz0.x),
+                mapStroke.xyz0.y + f * (mapStroke.xyz1.y - mapStroke.xyz0.y));
+    }
+    Quad<StepCoord> offset;
+    for (QuadIndex i = 0; i < 3; i++) {
+        PH5TYPE dpdz = mapStroke.dpdz0[i] + f * (mapStroke.dpdz1[i] - mapStroke.dpdz0[i]);
+        PH5TYPE pulses = h * dpdz;
+        offset.value[i] = (StepCoord)(pulses < 0 ? pulses - 0.5 : pulses + 0.5) - mapOffset.value[i];
+    }
+    return offset;
+}
+
+/**
+ * Bilinear height in millimeters at px,py, clamped to the map edges
+ */
+PH5TYPE HeightMap::height(PH5TYPE px, PH5TYPE py) {
+    if (nx == 0 || ny == 0) {
+        return 0;
+    }
+    PH5TYPE u = dx ? (px - x) / dx : 0;
+    PH5TYPE v = dy ? (py - y) / dy : 0;
+    u = u < 0 ? 0 : (u > nx - 1 ? nx - 1 : u);
+    v = v < 0 ? 0 : (v > ny - 1 ? ny - 1 : v);
+    uint8_t i = nx > 1 && u >= nx - 1 ? nx - 2 : (uint8_t) u;
+    uint8_t j = ny > 1 && v >= ny - 1 ? ny - 2 : (uint8_t) v;
+    uint8_t i1 = nx > 1 ? i + 1 : i;
+    uint8_t j1 = ny > 1 ? j + 1 : j;
+    PH5TYPE fu = u - i;
+    PH5TYPE fv = v - j;
+    PH5TYPE z0 = z[j * nx + i] * (1 - fu) + z[j * nx + i1] * fu;
+    PH5TYPE z1 = z[j1 * nx + i] * (1 - fu) + z[j1 * nx + i1] * fu;
+    return (z0 * (1 - fv) + z1 * fv) / 1000;
+}
+
 char * Machine::saveSysConfig(char *out, size_t maxLen) {
 	*out++ = '{';
 	out = saveConfigValue("ah", autoHome, out);
@@ -787,6 +999,86 @@ char * Machine::saveDimConfig(char *out, size_t maxLen) {
     return out;
 }
 
+void Machine::saveConfig(MachineConfig &cfg) {
+    memset((void *) &cfg, 0, sizeof(cfg)); // deterministic padding for CRC
+    cfg.version = CONFIG_VERSION;
+    cfg.size = sizeof(cfg);
+    cfg.hash = hash();
+    cfg.pinConfig = pinConfig;
+    cfg.pinStatus = pinStatus;
+    cfg.topology = topology;
+    cfg.outputMode = outputMode;
+    cfg.autoHome = autoHome;
+    cfg.autoSync = autoSync;
+    cfg.invertLim = invertLim;
+    cfg.jsonPrettyPrint = jsonPrettyPrint;
+    cfg.debounce = debounce;
+    cfg.homingPulses = homingPulses;
+    cfg.latchBackoff = latchBackoff;
+    cfg.searchDelay = searchDelay;
+    cfg.vMax = vMax;
+    cfg.tvMax = tvMax;
+    for (AxisIndex i=0; i<AXIS_COUNT; i++) {
+        axis[i].saveConfig(cfg.axis[i]);
+    }
+    cfg.delta = delta;
+}
+
+/**
+ * Apply configuration image with the same side effects as the
+ * equivalent JSON configuration commands
+ */
+void Machine::loadConfig(const MachineConfig &cfg) {
+    setPinConfig((PinConfig) cfg.pinConfig);
+    if (pinStatus != cfg.pinStatus) {
+        pinStatus = cfg.pinStatus;
+        pDisplay->setup(pinStatus);
+    }
+    outputMode = (OutputMode) cfg.outputMode;
+    autoHome = cfg.autoHome;
+    autoSync = cfg.autoSync;
+    invertLim = cfg.invertLim;
+    jsonPrettyPrint = cfg.jsonPrettyPrint;
+    debounce = cfg.debounce;
+    homingPulses = cfg.homingPulses;
+    latchBackoff = cfg.latchBackoff;
+    searchDelay = cfg.searchDelay;
+    vMax = cfg.vMax;
+    tvMax = cfg.tvMax;
+    delta = cfg.delta;
+    setTopology((Topology) cfg.topology);
+    for (AxisIndex i=0; i<AXIS_COUNT; i++) {
+        axis[i].loadConfig(cfg.axis[i]);
+    }
+    invalidateHash();
+    syncHash = cfg.hash;
+}
+
+void Machine::setTopology(Topology value) {
+    if (value == topology) {
+        return;
+    }
+    topology = value;
+    switch (topology) {
+    case MTO_RAW:
+    default:
+        break;
+    case MTO_FPD:
+        delta.setup();
+        if (axis[0].home >= 0 && axis[1].home >= 0 && axis[2].home >= 0) {
+            // Delta always has negateve home limit switch
+            Step3D home = delta.getHomePulses();
+            axis[0].position += home.p1-axis[0].home;
+            axis[1].position += home.p2-axis[1].home;
+            axis[2].position += home.p3-axis[2].home;
+            axis[0].home = home.p1;
+            axis[1].home = home.p2;
+            axis[2].home = home.p3;
+        }
+        break;
+    }
+}
+
 void Machine::enableEEUser(bool enable) {
 	if (isEEUserEnabled() != enable) {
 		eeprom_write_byte((uint8_t *)EEUSER_ENABLED, (uint8_t)(enable ? 'y' : 'n'));
@@ -25,18 +25,63 @@ namespace firestep {
 #define MICROSTEPS_DEFAULT 16
 #define INDEX_NONE -1
 #define PROBE_DATA 9
+#define PROBE_GRID_CHUNK 8 // grid probe Z values per streamed line
+#define PROBE_GRID_ZHOP 5 // default grid probe travel height in mm
+#define PROBE_FAST_PULSES 200 // maximum pulses per two-phase probe pass
+#define HEIGHT_MAP_POINTS 49 // height map grid points (e.g., 7x7)
+// EEPROM layout: config JSON at 0, configuration images below EEUSER_ENABLED
+// and user data from EEUSER. Only the configuration images rotate; the JSON is
+// rewritten in place, byte by byte and only where changed, so it wears only
+// when the configuration changes.
 #define EEUSER 2000
 #define EEUSER_ENABLED (EEUSER-1)
+#define EECONFIG_SLOTS 2 /* configuration image slots for wear leveling */
+#define EECONFIG_SLOT_BYTES 224
+#define EECONFIG (EEUSER_ENABLED-EECONFIG_SLOTS*EECONFIG_SLOT_BYTES) /* binary configuration images (MachineConfig) */
+#define CONFIG_VERSION 1
+
+/**
+ * Print to EEPROM, accumulating a CRC and counting changed bytes.
+ * Only changed bytes are written, and only if update is true.
+ */
+typedef class EEPROMPrint : public Print {
+public:
+    uint8_t *addr;
+    uint8_t *end;
+    uint16_t crc;
+    uint16_t changes;
+    bool update;
+
+    EEPROMPrint(uint8_t *addr, uint8_t *end, bool update)
+        : addr(addr), end(end), crc(0), changes(0), update(update) {}
+    virtual size_t write(uint8_t c) {
+        if (addr >= end) {
+            addr++; // overflow
+            return 0;
+        }
+        if (eeprom_read_byte(addr) != c) {
+            changes++;
+            if (update) {
+                eeprom_write_byte(addr, c);
+            }
+        }
+        addr++;
+        crc = crc16_update(crc, c);
+        return 1;
+    }
+} EEPROMPrint;
 
 typedef int16_t DelayMics; // delay microseconds
 #ifdef TEST
-extern int32_t delayMicsTotal;
+extern MCU_LOCAL int32_t delayMicsTotal;
 #endif
 
 enum OutputMode {
     OUTPUT_ARRAY1=0, //  JSON command arrays only return last command response
     OUTPUT_ARRAYN=1, // JSON command arrays return all command responses
 	OUTPUT_CMT=2, // Write comments 
+	OUTPUT_XONXOFF=4, // XOFF serial input while busy and queue input instead of cancelling
+	OUTPUT_MSGPACK=8, // MessagePack requests and responses instead of JSON text
 };
 
 /**
@@ -69,12 +114,28 @@ enum AxisIndexValue {
     NO_AXIS = INDEX_NONE
 };
 
+/**
+ * Binary image of Axis configuration
+ */
+typedef struct AxisConfig {
+    StepCoord	home;
+    StepCoord	travelMin;
+    StepCoord	travelMax;
+    DelayMics	usDelay;
+    DelayMics	idleSnooze;
+    float		stepAngle;
+    uint8_t		microsteps;
+    bool		dirHIGH;
+    bool		enabled;
+} AxisConfig;
+
 typedef class Axis {
     friend void ::test_Home();
     friend class Machine;
 
 private:
     bool		enabled; // true: stepper drivers are enabled and powered
+    bool		hashDirty; // true: configuration changed since last Machine::hash()
 
 public: // configuration
     StepCoord	home; // home position
@@ -100,6 +161,7 @@ public:
 
     Axis() :
         enabled(false),
+        hashDirty(true),
         pinStep(NOPIN),
         pinDir(NOPIN),
         pinMin(NOPIN),
@@ -123,9 +185,14 @@ public:
     int32_t hash();
     Status enable(bool active);
     char * saveConfig(char *out, size_t maxLen);
+    void saveConfig(AxisConfig &cfg);
+    void loadConfig(const AxisConfig &cfg);
     bool isEnabled() {
         return enabled;
     }
+    inline void invalidateHash() {
+        hashDirty = true;
+    }
     inline Status pinMode(PinType pin, int mode) {
         if (pin == NOPIN) {
             return STATUS_NOPIN;
@@ -175,6 +242,12 @@ enum ProbeDataSource {
     PDS_Z = 1, // Cartesian Z-coordinate
 };
 
+enum ProbePhase {
+    PROBE_APPROACH = 0, // fast approach until contact
+    PROBE_RETRACT = 1, // fast retract along the probe path
+    PROBE_SEARCH = 2, // search at the search delay until contact
+};
+
 typedef class OpProbe {
 public:
     Quad<StepCoord> start; // probe starting point
@@ -185,6 +258,10 @@ public:
     ProbeDataSource	dataSource;
     bool			probing;
     bool			invertProbe; // invert logic sense of probe
+    DelayMics		fastDelay; // fast approach pulse delay (0: single pulse search)
+    StepCoord		retract; // retract pulses before slow re-probe (0: latchBackoff)
+    StepCoord		retractDelta; // probe path point that ends the retract
+    ProbePhase		phase; // two-phase probe progress
     PH5TYPE			probeData[PROBE_DATA];
 
     OpProbe() : pinProbe(NOPIN), invertProbe(false) {
@@ -203,6 +280,10 @@ public:
         }
         curDelta = 0;
         dataSource = PDS_NONE;
+        fastDelay = 0;
+        retract = 0;
+        retractDelta = 0;
+        phase = PROBE_APPROACH;
         if (pinProbe == NOPIN) {
             probing = false;
         } else {
@@ -222,7 +303,126 @@ public:
     }
 } OpProbe;
 
-typedef class Machine : public QuadStepper {
+/**
+ * Grid probe of nx columns by ny rows visited in serpentine order.
+ * Even rows are probed in increasing X and odd rows in decreasing X.
+ */
+typedef class OpProbeGrid {
+public:
+    PH5TYPE			x; // first point X
+    PH5TYPE			y; // first point Y
+    PH5TYPE			dx; // column pitch
+    PH5TYPE			dy; // row pitch
+    PH5TYPE			zEnd; // probe goal Z
+    PH5TYPE			zHop; // travel height above previous contact
+    PH5TYPE			zContact; // previous contact Z
+    PH5TYPE			zFirst; // first contact Z, the height map reference
+    uint8_t			nx; // columns
+    uint8_t			ny; // rows
+    uint16_t		index; // current point in visit order
+    bool			travelling; // moving to current point
+    bool			lifting; // rising zHop above previous contact before travel
+    DelayMics		fastDelay; // OpProbe::fastDelay for each point
+    StepCoord		retract; // OpProbe::retract for each point
+    uint8_t			chunkLen;
+    PH5TYPE			chunk[PROBE_GRID_CHUNK]; // contact Z in visit order
+
+    OpProbeGrid() {
+        setup();
+    }
+    void setup() {
+        x = y = 0;
+        dx = dy = 0;
+        zEnd = zContact = zFirst = 0;
+        zHop = PROBE_GRID_ZHOP;
+        nx = ny = 1;
+        index = 0;
+        travelling = true;
+        lifting = false;
+        fastDelay = 0;
+        retract = 0;
+        chunkLen = 0;
+    }
+    uint16_t size() {
+        return (uint16_t) nx * ny;
+    }
+    uint8_t row(uint16_t i) {
+        return i / nx;
+    }
+    uint8_t column(uint16_t i) {
+        uint8_t c = i % nx;
+        return (row(i) & 1) ? nx - 1 - c : c;
+    }
+    PH5TYPE pointX(uint16_t i) {
+        return x + column(i) * dx;
+    }
+    PH5TYPE pointY(uint16_t i) {
+        return y + row(i) * dy;
+    }
+} OpProbeGrid;
+
+/**
+ * Bilinear bed height map for MTO_FPD Z compensation, with the same grid
+ * geometry as OpProbeGrid. Heights are stored row-major in microns.
+ */
+typedef class HeightMap {
+public:
+    PH5TYPE			x; // first point X
+    PH5TYPE			y; // first point Y
+    PH5TYPE			dx; // column pitch
+    PH5TYPE			dy; // row pitch
+    uint8_t			nx; // columns
+    uint8_t			ny; // rows
+    bool			enabled; // compensate MTO_FPD moves
+    int16_t			z[HEIGHT_MAP_POINTS]; // height at each point (microns)
+
+    HeightMap() {
+        clear();
+    }
+    void clear() {
+        x = y = 0;
+        dx = dy = 0;
+        nx = ny = 0;
+        enabled = false;
+        memset(z, 0, sizeof(z));
+    }
+    PH5TYPE height(PH5TYPE px, PH5TYPE py);
+} HeightMap;
+
+/**
+ * Versioned binary image of the configuration saved by syncConfig().
+ * Boot loads it directly if it was saved by the same firmware layout
+ * from the current EEPROM config JSON.
+ */
+typedef struct MachineConfig {
+    uint8_t		version; // CONFIG_VERSION
+    uint16_t	size; // sizeof(MachineConfig)
+    uint16_t	generation; // incremented by each save to a new slot
+    uint16_t	crcJson; // CRC of config JSON at EEPROM address 0
+    int32_t		hash; // Machine::hash() of saved configuration
+    uint8_t		pinConfig;
+    PinType		pinStatus;
+    uint8_t		topology;
+    uint8_t		outputMode;
+    bool		autoHome;
+    bool		autoSync;
+    bool		invertLim;
+    bool		jsonPrettyPrint;
+    uint8_t		debounce;
+    int16_t		homingPulses;
+    StepCoord	latchBackoff;
+    DelayMics	searchDelay;
+    int32_t		vMax;
+    PH5TYPE		tvMax;
+    AxisConfig	axis[AXIS_COUNT];
+    DeltaCalculator delta;
+    uint16_t	crc; // CRC of all preceding bytes
+} MachineConfig;
+
+// Compile-time check: a larger MachineConfig would overwrite EEUSER
+typedef char MachineConfigFitsSlot[sizeof(MachineConfig) <= EECONFIG_SLOT_BYTES ? 1 : -1];
+
+typedef class Machine : public QuadStepper, public StrokeOffset {
     friend void ::test_Home();
 
 public:
@@ -246,9 +446,16 @@ public:
     OutputMode	outputMode;
     struct {
         OpProbe		probe;
+        OpProbeGrid	grid;
     } op;
+    HeightMap	heightMap;
+    Quad<StepCoord> mapOffset; // height map compensation included in motor positions
 	int32_t		syncHash;
 
+protected:
+	int32_t		hashCache; // last value computed by hash()
+	bool		hashDirty; // true: hashCache must be recomputed
+
 public:
     Axis 		axis[AXIS_COUNT];
     Display*	pDisplay;
@@ -256,16 +463,31 @@ public:
     Stroke		stroke;
 
 protected:
+    struct {
+        XYZ3D		xyz0; // nominal stroke start
+        XYZ3D		xyz1; // nominal stroke end
+        PH5TYPE		dpdz0[3]; // pulses per Z millimeter at stroke start
+        PH5TYPE		dpdz1[3]; // pulses per Z millimeter at stroke end
+        QuadIndex	iMax; // motor with the longest travel
+        StepCoord	dMax; // travel of motor iMax
+    } mapStroke;
     Status	 	stepProbe(int16_t delay);
+    Status	 	stepProbeTo(StepCoord delta, int16_t delay);
+    Status	 	probeFast(int16_t delay);
+    bool		probeContact();
     Status		setPinConfig_EMC02();
     Status 		setPinConfig_RAMPS1_4();
     void 		backoffHome(int16_t delay);
     StepCoord 	stepHome(StepCoord pulsesPerAxis, int16_t delay);
+    int32_t		calcHash();
 
 public:
     Machine();
 	void setup(PinConfig cfg);
     int32_t hash();
+    inline void invalidateHash() {
+        hashDirty = true;
+    }
     virtual	Status step(const Quad<StepDV> &pulse);
     bool isCorePin(int16_t pin);
     inline bool isAtLimit(PinType pin) {
@@ -343,8 +565,15 @@ public:
         return pinConfig;
     }
     XYZ3D getXYZ3D();
+    void beginMapStroke(Quad<StepCoord> dPos);
+    void endMapStroke();
+    Quad<StepCoord> mapCorrection();
+    virtual Quad<StepCoord> strokeOffset(const Quad<StepCoord> &dPos);
     char * saveSysConfig(char *out, size_t maxLen);
     char * saveDimConfig(char *out, size_t maxLen);
+    void saveConfig(MachineConfig &cfg);
+    void loadConfig(const MachineConfig &cfg);
+    void setTopology(Topology value);
     Status idle(Status status);
     Status sync(Status status);
 	void enableEEUser(bool enable);
@@ -352,7 +581,7 @@ public:
 } Machine;
 
 #ifdef TEST
-extern int32_t delayMicsTotal;
+extern MCU_LOCAL int32_t delayMicsTotal;
 #endif
 
 char * saveConfigValue(const char *key, const char *value, char *out);
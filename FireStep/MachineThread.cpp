@@ -8,6 +8,26 @@
 
 using namespace firestep;
 
+#define XON 0x11
+#define XOFF 0x13
+#define SERIAL_XOFF_BYTES 48 // receive buffer high-water mark (of 64 bytes)
+#define SERIAL_XON_BYTES 16 // receive buffer low-water mark
+
+/**
+ * Return CRC of EEPROM text at addr up to its terminator
+ */
+static uint16_t eeprom_text_crc(uint8_t *addr, uint8_t *end) {
+    uint16_t crc = 0;
+    for (; addr < end; addr++) {
+        uint8_t c = eeprom_read_byte(addr);
+        if (c == 0 || c == 255) {
+            break;
+        }
+        crc = crc16_update(crc, c);
+    }
+    return crc;
+}
+
 void MachineThread::setup(PinConfig pc) {
     id = 'M';
 #ifdef THROTTLE_SPEED
@@ -22,7 +42,8 @@ void MachineThread::setup(PinConfig pc) {
 
 MachineThread::MachineThread()
 //: status(STATUS_BUSY_SETUP) , controller(machine) {
-    : status(STATUS_WAIT_IDLE) , controller(machine), printBannerOnIdle(true) {
+    : status(STATUS_WAIT_IDLE) , controller(machine), printBannerOnIdle(true),
+      serialPaused(false) {
 }
 
 void MachineThread::displayStatus() {
@@ -89,14 +110,25 @@ size_t MachineThread::readEEPROM(uint8_t *eeprom_addr, char *dst, size_t maxLen)
     return len;
 }
 
-char * MachineThread::buildStartupJson() {
+/**
+ * Return startup JSON array of config JSON and user EEPROM JSON.
+ * If config is false, the config JSON is omitted since the configuration
+ * image has been loaded, and only autoHome is executed.
+ */
+char * MachineThread::buildStartupJson(bool config) {
     command.clear();
     char *buf = command.allocate(MAX_JSON);
     ASSERT(buf);
 
     size_t len = 0;
     buf[len++] = '[';
-    len += readEEPROM((uint8_t*)(size_t) 0, buf+len, MAX_JSON-len);
+    if (config) {
+        len += readEEPROM((uint8_t*)(size_t) 0, buf+len, MAX_JSON-len);
+    } else if (machine.autoHome) {
+        const char *hom = "{\"hom\":\"\"}";
+        strcpy(buf+len, hom);
+        len += strlen(hom);
+    }
     if (len > 1) {
 		if (buf[1] == '[') {
 			buf[1] = ' ';
@@ -130,8 +162,88 @@ char * MachineThread::buildStartupJson() {
 	return buf;
 }
 
+static uint16_t crc16_block(uint16_t crc, const void *data, size_t n) {
+    for (size_t i=0; i<n; i++) {
+        crc = crc16_update(crc, ((const uint8_t *) data)[i]);
+    }
+    return crc;
+}
+
+static void * configSlotAddr(int8_t slot) {
+    return (void *)(size_t)(EECONFIG + slot * EECONFIG_SLOT_BYTES);
+}
+
+/**
+ * Read the newest intact configuration image with the current layout.
+ * Return its slot, or -1 if there is none.
+ */
+int8_t MachineThread::readConfig(MachineConfig &cfg) {
+    int8_t newest = -1;
+    uint16_t generation = 0;
+	DisplayStatus ds = machine.pDisplay->getStatus();
+	machine.pDisplay->setStatus(DISPLAY_EEPROM);
+    for (int8_t slot=0; slot<EECONFIG_SLOTS; slot++) {
+        eeprom_read_block(&cfg, configSlotAddr(slot), sizeof(cfg));
+        if (cfg.version == CONFIG_VERSION && cfg.size == sizeof(cfg) &&
+                cfg.crc == crc16_block(0, &cfg, offsetof(MachineConfig, crc)) &&
+                (newest < 0 || (int16_t)(cfg.generation - generation) > 0)) {
+            newest = slot;
+            generation = cfg.generation;
+        }
+    }
+    if (newest >= 0 && newest != EECONFIG_SLOTS-1) {
+        eeprom_read_block(&cfg, configSlotAddr(newest), sizeof(cfg));
+    }
+	machine.pDisplay->setStatus(ds);
+    return newest;
+}
+
+/**
+ * Apply the binary configuration image saved by syncConfig(). The image is
+ * only used if it is intact, has the current layout and was saved with the
+ * current config JSON.
+ */
+Status MachineThread::loadConfig() {
+    MachineConfig cfg;
+    if (readConfig(cfg) < 0 ||
+            cfg.crcJson != eeprom_text_crc((uint8_t *) 0, (uint8_t *)(size_t) EECONFIG)) {
+        return STATUS_EEPROM_CONFIG;
+    }
+    machine.loadConfig(cfg);
+    return STATUS_OK;
+}
+
+/**
+ * Save the configuration image to the next slot with the next generation,
+ * leaving the current image intact until the new image is complete.
+ * Nothing is written if the configuration is unchanged.
+ */
+void MachineThread::saveConfig(uint16_t crcJson) {
+    MachineConfig cfg;
+    MachineConfig cfgOld;
+    int8_t slot = readConfig(cfgOld);
+    machine.saveConfig(cfg);
+    cfg.crcJson = crcJson;
+    if (slot >= 0) {
+        cfg.generation = cfgOld.generation;
+        cfg.crc = crc16_block(0, &cfg, offsetof(MachineConfig, crc));
+        if (memcmp(&cfg, &cfgOld, sizeof(cfg)) == 0) {
+            return; // unchanged
+        }
+        cfg.generation++;
+    }
+    slot = (slot + 1) % EECONFIG_SLOTS;
+    cfg.crc = crc16_block(0, &cfg, offsetof(MachineConfig, crc));
+    eeprom_update_block(&cfg, configSlotAddr(slot), sizeof(cfg));
+}
+
 Status MachineThread::executeEEPROM() {
-	char *buf = buildStartupJson();
+    bool config = loadConfig() != STATUS_OK;
+    TESTCOUT1("executeEEPROM config JSON:", config);
+	char *buf = buildStartupJson(config);
+    if (strcmp(buf, "[]") == 0) {
+        return STATUS_OK; // nothing else to execute
+    }
     TESTCOUT3("executeEEPROM:", buf, " len:", strlen(buf), " status:", (int) status);
     status = command.parse(buf, status);
     TESTCOUT2("executeEEPROM status:", (int) status, " buf:", buf);
@@ -139,7 +251,7 @@ Status MachineThread::executeEEPROM() {
 		Serial.print("{\"s\":");
 		Serial.print(status);
 		Serial.println(",\"r\":");
-		buf = buildStartupJson();
+		buf = buildStartupJson(config);
 		for (char *s = buf; *s; s++) {
 			Serial.print(*s);
 		}
@@ -204,29 +316,41 @@ Status MachineThread::syncConfig() {
 	}
 	*out++ = ']';
 	*out++ = '\n';
-    out += strlen(out);
+	*out = 0;
 
     // Save to EEPROM before executing config JSON (parsing is destructive)
 	DisplayStatus ds = machine.pDisplay->getStatus();
 	machine.pDisplay->setStatus(DISPLAY_EEPROM);
     size_t len = strlen(buf);
     uint8_t *eepAddr = 0;
-	eeprom_write_byte(eepAddr, ' '); // disable eeprom
-    for (int16_t i=1; i<=len; i++) { // include terminator
-        eeprom_write_byte(eepAddr+i, buf[i]);
-		//if (Serial.available()) { return; }
+    char enable = buf[0];
+    bool changed = eeprom_read_byte(eepAddr+len-1) != 0;
+    for (size_t i=0; !changed && i+1<len; i++) {
+        changed = eeprom_read_byte(eepAddr+i) != (uint8_t) buf[i];
+    }
+    if (changed) { // only write changed bytes
+        eeprom_update_byte(eepAddr, ' '); // disable eeprom
+        for (size_t i=1; i+1<len; i++) {
+            eeprom_update_byte(eepAddr+i, buf[i]);
+        }
+        eeprom_update_byte(eepAddr+len-1, 0); // terminate without EOL
     }
 	machine.pDisplay->setStatus(ds);
     TESTCOUT3("syncConfig len:", strlen(buf), " buf:", buf, " status:", (int) status);
+    uint16_t crcJson = 0;
+    for (size_t i=0; i+1<len; i++) { // exclude EOL
+        crcJson = crc16_update(crcJson, buf[i]);
+    }
     // Commit config JSON to EEPROM iff JSON is valid
     status = command.parse(buf, status);
     if (status == STATUS_BUSY_PARSED) {
 		machine.syncHash = machine.hash(); // commit saved
-        eeprom_write_byte(eepAddr, buf[0]); // enable eeprom
-        eeprom_write_byte(eepAddr+len-1, 0); // remove EOL
+        eeprom_update_byte(eepAddr, enable); // enable eeprom
+        saveConfig(crcJson);
 		status = STATUS_WAIT_IDLE;
 	} else {
 		machine.autoSync = false; // no point trying again
+		machine.invalidateHash();
     }
 	return status;
 }
@@ -239,6 +363,28 @@ void MachineThread::printBanner() {
 	Serial.println(msg);
 }
 
+/**
+ * Serial input is only read while waiting. With XON/XOFF flow control the
+ * host holds input while we are busy, so that it queues instead of
+ * cancelling the command. XOFF is also sent as soon as the serial receive
+ * buffer fills to SERIAL_XOFF_BYTES, and XON waits for it to drain to
+ * SERIAL_XON_BYTES. MessagePack streams never carry XON/XOFF, since both
+ * bytes are valid MessagePack values.
+ */
+void MachineThread::flowControl() {
+    bool pause = false;
+    if (OUTPUT_XONXOFF == (machine.outputMode & (OUTPUT_XONXOFF | OUTPUT_MSGPACK)) &&
+            !command.isMsgPack()) {
+        int pending = Serial.available();
+        pause = isProcessing(status) || pending >= SERIAL_XOFF_BYTES ||
+                (serialPaused && pending > SERIAL_XON_BYTES);
+    }
+    if (pause != serialPaused) {
+        Serial.write(pause ? XOFF : XON);
+        serialPaused = pause;
+    }
+}
+
 void MachineThread::loop() {
 #ifdef THROTTLE_SPEED
 	if (Serial.available()) { return; }
@@ -255,6 +401,7 @@ void MachineThread::loop() {
     }
 #endif
 
+    flowControl();
     switch (status) {
     default:
     case STATUS_WAIT_IDLE:
@@ -265,6 +412,7 @@ void MachineThread::loop() {
     case STATUS_WAIT_CANCELLED:
         if (Serial.available()) {
             command.clear();
+            command.setMsgPack(OUTPUT_MSGPACK == (machine.outputMode & OUTPUT_MSGPACK));
             status = command.parse(NULL, status);
         } else {
 			if (printBannerOnIdle) {
@@ -284,7 +432,7 @@ void MachineThread::loop() {
     case STATUS_BUSY:
     case STATUS_BUSY_CALIBRATING:
     case STATUS_BUSY_MOVING:
-        if (Serial.available()) {
+        if (Serial.available() && !serialPaused) {
             status = controller.cancel(command, STATUS_SERIAL_CANCEL);
         } else {
             status = controller.process(command);
@@ -303,14 +451,15 @@ void MachineThread::loop() {
         }
         break;
     }
-    case STATUS_OK:
+    case STATUS_OK: {
 		status = STATUS_WAIT_IDLE;
-		if (machine.syncHash != machine.hash()) {
+		int32_t hash = machine.hash(); // cached until configuration changes
+		if (machine.syncHash != hash) {
 			if (machine.autoSync) {
-				TESTCOUT2("STATUS_OK autoSync syncHash:", machine.syncHash, " hash:", machine.hash());
+				TESTCOUT2("STATUS_OK autoSync syncHash:", machine.syncHash, " hash:", hash);
 				status = syncConfig();
 			} else {
-				TESTCOUT2("STATUS_OK syncHash:", machine.syncHash, " hash:", machine.hash());
+				TESTCOUT2("STATUS_OK syncHash:", machine.syncHash, " hash:", hash);
 			}
 			if (machine.syncHash != 0 && machine.isEEUserEnabled()) {
 				TESTCOUT1("STATUS_OK user EEPROM:", "disabled");
@@ -319,7 +468,9 @@ void MachineThread::loop() {
 		}
         break;
     }
+    }
 
+    flowControl();
     displayStatus();
 
     nextLoop.ticks = 0; // Highest priority
@@ -12,10 +12,13 @@ typedef class MachineThread : Thread {
 
 protected:
     void displayStatus();
-	char * buildStartupJson();
+	char * buildStartupJson(bool config = true);
     Status executeEEPROM();
+    Status loadConfig();
+    void saveConfig(uint16_t crcJson);
     size_t readEEPROM(uint8_t *eeprom_addr, char *dst, size_t maxLen);
 	void printBanner();
+    void flowControl();
 
 public:
     Status status;
@@ -23,12 +26,14 @@ public:
     JsonCommand command;
     JsonController controller;
 	bool printBannerOnIdle;
+	bool serialPaused; // XOFF sent to host
 
 public:
     MachineThread();
     void setup(PinConfig pc);
     void loop();
     Status syncConfig();
+    int8_t readConfig(MachineConfig &cfg);
 } MachineThread;
 
 } // namespace firestep
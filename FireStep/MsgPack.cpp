@@ -0,0 +1,486 @@
+#ifdef CMAKE
+#include <cstring>
+#endif
+#include "Arduino.h"
+#include "MsgPack.h"
+
+using namespace firestep;
+
+#define MSGPACK_STR 0xa0 // type of string body in progress
+
+static void writeBytes(Print &out, uint32_t value, uint8_t n) {
+    while (n-- > 0) {
+        out.write((uint8_t)(value >> (8 * n)));
+    }
+}
+
+void firestep::msgpackWriteArray(Print &out, uint8_t n) {
+    if (n < 16) {
+        out.write(0x90 | n);
+    } else {
+        out.write(0xdc);
+        writeBytes(out, n, 2);
+    }
+}
+
+void firestep::msgpackWriteMap(Print &out, uint8_t n) {
+    if (n < 16) {
+        out.write(0x80 | n);
+    } else {
+        out.write(0xde);
+        writeBytes(out, n, 2);
+    }
+}
+
+void firestep::msgpackWriteString(Print &out, const char *s) {
+    size_t len = strlen(s);
+    if (len < 32) {
+        out.write(0xa0 | len);
+    } else if (len < 256) {
+        out.write(0xd9);
+        out.write(len);
+    } else {
+        out.write(0xda);
+        writeBytes(out, len, 2);
+    }
+    while (*s) {
+        out.write(*s++);
+    }
+}
+
+void firestep::msgpackWriteLong(Print &out, int32_t value) {
+    if (0 <= value && value < 128) {
+        out.write(value);
+    } else if (-32 <= value && value < 0) {
+        out.write((uint8_t) value);
+    } else if (0 <= value && value < 256) {
+        out.write(0xcc);
+        writeBytes(out, value, 1);
+    } else if (0 <= value && value < 65536) {
+        out.write(0xcd);
+        writeBytes(out, value, 2);
+    } else if (-128 <= value && value < 128) {
+        out.write(0xd0);
+        writeBytes(out, value, 1);
+    } else if (-32768 <= value && value < 32768) {
+        out.write(0xd1);
+        writeBytes(out, value, 2);
+    } else {
+        out.write(0xd2);
+        writeBytes(out, value, 4);
+    }
+}
+
+void firestep::msgpackWriteFloat(Print &out, float value) {
+    union {
+        float f;
+        uint32_t u;
+    } bits;
+    bits.f = value;
+    out.write(0xca);
+    writeBytes(out, bits.u, 4);
+}
+
+void firestep::msgpackWriteVariant(Print &out, JsonVariant &value) {
+    if (value.is<JsonObject&>()) {
+        JsonObject &jobj = value;
+        msgpackWriteMap(out, jobj.size());
+        for (JsonObject::iterator it = jobj.begin(); it != jobj.end(); ++it) {
+            msgpackWriteString(out, it->key);
+            msgpackWriteVariant(out, it->value);
+        }
+    } else if (value.is<JsonArray&>()) {
+        JsonArray &jarr = value;
+        msgpackWriteArray(out, jarr.size());
+        for (JsonArray::iterator it = jarr.begin(); it != jarr.end(); ++it) {
+            msgpackWriteVariant(out, *it);
+        }
+    } else if (value.is<const char *>()) {
+        const char *s = value;
+        msgpackWriteString(out, s);
+    } else if (value.is<bool>()) {
+        bool b = value;
+        out.write(b ? 0xc3 : 0xc2);
+    } else if (value.is<long>()) {
+        long n = value;
+        msgpackWriteLong(out, n);
+    } else if (value.is<double>()) {
+        double d = value;
+        msgpackWriteFloat(out, d);
+    } else {
+        out.write(0xc0); // nil
+    }
+}
+
+void MsgPackDecoder::clear() {
+    depth = 0;
+    type = 0;
+    need = 0;
+    value = 0;
+    done = false;
+}
+
+static bool isContainer(uint8_t c) {
+    return (c & 0xe0) == 0x80 || c == 0xdc || c == 0xde; // map or array
+}
+
+Status MsgPackDecoder::endItem() {
+    while (depth > 0) {
+        uint8_t level = depth - 1;
+        if (++index[level] < count[level]) {
+            return STATUS_WAIT_EOL;
+        }
+        depth--;
+    }
+    done = true;
+    return STATUS_OK;
+}
+
+Status MsgPackDecoder::open(bool isMap, uint16_t n) {
+    uint16_t items = isMap ? 2 * n : n;
+    if (depth >= MSGPACK_DEPTH || items > 255) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    if (items == 0) {
+        return endItem();
+    }
+    count[depth] = items;
+    index[depth] = 0;
+    depth++;
+    return STATUS_WAIT_EOL;
+}
+
+Status MsgPackDecoder::beginString(uint16_t len) {
+    if (len == 0) {
+        return endItem();
+    }
+    type = MSGPACK_STR;
+    need = len;
+    return STATUS_WAIT_EOL;
+}
+
+Status MsgPackDecoder::decodeHeader(uint8_t c) {
+    if (depth == 0 && !isContainer(c)) {
+        return STATUS_JSON_PARSE_ERROR; // commands are maps or arrays
+    }
+    type = c;
+    value = 0;
+    if (c <= 0x7f || c >= 0xe0) { // fixint
+        return endItem();
+    }
+    switch (c & 0xf0) {
+    case 0x80:
+        return open(true, c & 0x0f);
+    case 0x90:
+        return open(false, c & 0x0f);
+    case 0xa0:
+    case 0xb0:
+        return beginString(c & 0x1f);
+    }
+    switch (c) {
+    case 0xc0:
+    case 0xc2:
+    case 0xc3:
+        return endItem();
+    case 0xcc:
+    case 0xd0:
+    case 0xd9:
+        need = 1;
+        return STATUS_WAIT_EOL;
+    case 0xcd:
+    case 0xd1:
+    case 0xda:
+    case 0xdc:
+    case 0xde:
+        need = 2;
+        return STATUS_WAIT_EOL;
+    case 0xca:
+    case 0xce:
+    case 0xd2:
+        need = 4;
+        return STATUS_WAIT_EOL;
+    default:
+        return STATUS_JSON_PARSE_ERROR;
+    }
+}
+
+Status MsgPackDecoder::decodeValue() {
+    switch (type) {
+    case 0xd9:
+    case 0xda:
+        return beginString(value);
+    case 0xdc:
+        return open(false, value);
+    case 0xde:
+        return open(true, value);
+    default:
+        return endItem();
+    }
+}
+
+Status MsgPackDecoder::decodeByte(uint8_t c) {
+    if (need == 0) {
+        return decodeHeader(c);
+    }
+    if (type != MSGPACK_STR) {
+        value = (value << 8) | c;
+    }
+    if (--need > 0) {
+        return STATUS_WAIT_EOL;
+    }
+    return type == MSGPACK_STR ? endItem() : decodeValue();
+}
+
+Status MsgPackDecoder::decode(uint8_t c, char *&dst, char *dstEnd) {
+    if (resync) {
+        if (!isContainer(c)) {
+            return STATUS_WAIT_IDLE; // dropped
+        }
+        resync = false;
+    }
+    Status status;
+    if (done) {
+        status = STATUS_JSON_PARSE_ERROR;
+    } else if (dst >= dstEnd) {
+        status = STATUS_JSON_TOO_LONG;
+    } else {
+        *dst++ = c;
+        status = decodeByte(c);
+    }
+    resync = status < 0;
+    return status;
+}
+
+bool MsgPackReader::readBytes(uint8_t n, uint32_t &value) {
+    if (end - pos < n) {
+        return false;
+    }
+    value = 0;
+    while (n-- > 0) {
+        value = (value << 8) | (uint8_t) *pos++;
+    }
+    return true;
+}
+
+/**
+ * Return the item count or string length for header byte c
+ */
+Status MsgPackReader::readLength(uint8_t c, uint16_t &n) {
+    uint32_t value;
+    switch (c) {
+    case 0xd9:
+        if (!readBytes(1, value)) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        break;
+    case 0xda:
+    case 0xdc:
+    case 0xde:
+        if (!readBytes(2, value)) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        break;
+    default:
+        value = (c & 0xe0) == 0xa0 ? (c & 0x1f) : (c & 0x0f);
+        break;
+    }
+    n = value;
+    return STATUS_OK;
+}
+
+Status MsgPackReader::readString(uint16_t len, const char *&str) {
+    if (end - pos < len) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    char *s = pos - 1; // overwrite last header byte
+    memmove(s, pos, len);
+    s[len] = 0;
+    pos += len;
+    str = s;
+    return STATUS_OK;
+}
+
+template<class T>
+static void addValue(JsonArray *pjarr, JsonObject *pjobj, const char *key, T value) {
+    if (pjarr) {
+        pjarr->add(value);
+    } else {
+        (*pjobj)[key] = value;
+    }
+}
+
+/**
+ * Read one value and add it to pjarr or set it as pjobj[key]
+ */
+Status MsgPackReader::readItem(JsonArray *pjarr, JsonObject *pjobj, const char *key) {
+    if (pos >= end) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    uint8_t c = (uint8_t) *pos++;
+    uint32_t value;
+    uint16_t n;
+    Status status;
+    if (c <= 0x7f) {
+        addValue(pjarr, pjobj, key, (long) c);
+    } else if (c >= 0xe0) {
+        addValue(pjarr, pjobj, key, (long)(int8_t) c);
+    } else if ((c & 0xf0) == 0x80 || c == 0xde) {
+        if ((status = readLength(c, n)) != STATUS_OK) {
+            return status;
+        }
+        JsonObject &jnode = pjarr ? pjarr->createNestedObject() : pjobj->createNestedObject(key);
+        if (!jnode.success()) {
+            return STATUS_JSON_MEM1;
+        }
+        return readObject(jnode, n);
+    } else if ((c & 0xf0) == 0x90 || c == 0xdc) {
+        if ((status = readLength(c, n)) != STATUS_OK) {
+            return status;
+        }
+        JsonArray &jnode = pjarr ? pjarr->createNestedArray() : pjobj->createNestedArray(key);
+        if (!jnode.success()) {
+            return STATUS_JSON_MEM1;
+        }
+        return readArray(jnode, n);
+    } else if ((c & 0xe0) == 0xa0 || c == 0xd9 || c == 0xda) {
+        const char *s;
+        if ((status = readLength(c, n)) != STATUS_OK ||
+                (status = readString(n, s)) != STATUS_OK) {
+            return status;
+        }
+        addValue(pjarr, pjobj, key, s);
+    } else {
+        switch (c) {
+        case 0xc0:
+            addValue(pjarr, pjobj, key, (const char *) NULL);
+            return STATUS_OK;
+        case 0xc2:
+        case 0xc3:
+            addValue(pjarr, pjobj, key, c == 0xc3);
+            return STATUS_OK;
+        case 0xcc:
+        case 0xd0:
+            if (!readBytes(1, value)) {
+                return STATUS_JSON_PARSE_ERROR;
+            }
+            addValue(pjarr, pjobj, key, c == 0xcc ? (long) value : (long)(int8_t) value);
+            return STATUS_OK;
+        case 0xcd:
+        case 0xd1:
+            if (!readBytes(2, value)) {
+                return STATUS_JSON_PARSE_ERROR;
+            }
+            addValue(pjarr, pjobj, key, c == 0xcd ? (long) value : (long)(int16_t) value);
+            return STATUS_OK;
+        case 0xd2:
+            if (!readBytes(4, value)) {
+                return STATUS_JSON_PARSE_ERROR;
+            }
+            addValue(pjarr, pjobj, key, (long)(int32_t) value);
+            return STATUS_OK;
+        case 0xce:
+            if (!readBytes(4, value) || value > 0x7fffffff) {
+                return STATUS_JSON_PARSE_ERROR;
+            }
+            addValue(pjarr, pjobj, key, (long) value);
+            return STATUS_OK;
+        case 0xca: {
+            if (!readBytes(4, value)) {
+                return STATUS_JSON_PARSE_ERROR;
+            }
+            union {
+                uint32_t u;
+                float f;
+            } bits;
+            bits.u = value;
+            if (!(-2e9 < bits.f && bits.f < 2e9)) {
+                return STATUS_JSON_PARSE_ERROR; // NaN or out of range
+            }
+            if (pjarr) {
+                pjarr->add((double) bits.f, 3);
+            } else {
+                (*pjobj)[key].set((double) bits.f, 3);
+            }
+            return STATUS_OK;
+        }
+        default:
+            return STATUS_JSON_PARSE_ERROR;
+        }
+    }
+    return STATUS_OK;
+}
+
+Status MsgPackReader::readArray(JsonArray &jarr, uint16_t n) {
+    if (++depth > MSGPACK_DEPTH) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        Status status = readItem(&jarr, NULL, NULL);
+        if (status != STATUS_OK) {
+            return status;
+        }
+    }
+    depth--;
+    return STATUS_OK;
+}
+
+Status MsgPackReader::readObject(JsonObject &jobj, uint16_t n) {
+    if (++depth > MSGPACK_DEPTH) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        if (pos >= end) {
+            return STATUS_JSON_PARSE_ERROR;
+        }
+        uint8_t c = (uint8_t) *pos++;
+        uint16_t len;
+        const char *key;
+        if ((c & 0xe0) != 0xa0 && c != 0xd9 && c != 0xda) {
+            return STATUS_JSON_PARSE_ERROR; // keys must be strings
+        }
+        Status status = readLength(c, len);
+        if (status == STATUS_OK) {
+            status = readString(len, key);
+        }
+        if (status == STATUS_OK) {
+            status = readItem(NULL, &jobj, key);
+        }
+        if (status != STATUS_OK) {
+            return status;
+        }
+    }
+    depth--;
+    return STATUS_OK;
+}
+
+bool MsgPackReader::isObject() {
+    return pos < end && ((*pos & 0xf0) == 0x80 || (uint8_t) *pos == 0xde);
+}
+
+Status MsgPackReader::read(JsonArray &jarr) {
+    uint16_t n;
+    if (pos >= end) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    uint8_t c = (uint8_t) *pos++;
+    if ((c & 0xf0) != 0x90 && c != 0xdc) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    Status status = readLength(c, n);
+    if (status == STATUS_OK) {
+        status = readArray(jarr, n);
+    }
+    return status == STATUS_OK && pos != end ? STATUS_JSON_PARSE_ERROR : status;
+}
+
+Status MsgPackReader::read(JsonObject &jobj) {
+    uint16_t n;
+    if (!isObject()) {
+        return STATUS_JSON_PARSE_ERROR;
+    }
+    Status status = readLength((uint8_t) *pos++, n);
+    if (status == STATUS_OK) {
+        status = readObject(jobj, n);
+    }
+    return status == STATUS_OK && pos != end ? STATUS_JSON_PARSE_ERROR : status;
+}
@@ -0,0 +1,99 @@
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include "Arduino.h"
+#ifdef TEST
+#include "ArduinoJson.h"
+#else
+#include <ArduinoJson.h>
+#endif
+#include "Status.h"
+
+namespace firestep {
+
+#define MSGPACK_DEPTH 6 // maximum nesting of decoded maps and arrays
+
+/**
+ * MessagePack wire format for the JSON command tree (sysom:8).
+ * Supported types are nil, bool, int8..int32, uint8..uint32, float32,
+ * str8/str16, array16 and map16 with their fixed-size variants.
+ */
+void msgpackWriteMap(Print &out, uint8_t n);
+void msgpackWriteArray(Print &out, uint8_t n);
+void msgpackWriteString(Print &out, const char *s);
+void msgpackWriteLong(Print &out, int32_t value);
+void msgpackWriteFloat(Print &out, float value);
+void msgpackWriteVariant(Print &out, JsonVariant &value);
+
+/**
+ * Frames MessagePack input one byte at a time. Each byte is copied to dst
+ * while container nesting is tracked to find the end of the top-level map
+ * or array, which MsgPackReader then reads straight into the request tree.
+ * After an error, input is dropped until the next map or array header.
+ */
+typedef class MsgPackDecoder {
+private:
+    uint8_t depth;
+    uint8_t count[MSGPACK_DEPTH]; // items in container (maps count keys and values)
+    uint8_t index[MSGPACK_DEPTH]; // items completed in container
+    uint8_t type; // header byte of value in progress
+    uint16_t need; // bytes remaining in value in progress
+    uint32_t value; // big-endian length accumulator
+    bool done;
+    bool resync; // dropping input after an error (kept by clear())
+
+private:
+    Status endItem();
+    Status open(bool isMap, uint16_t n);
+    Status beginString(uint16_t len);
+    Status decodeHeader(uint8_t c);
+    Status decodeValue();
+    Status decodeByte(uint8_t c);
+
+public:
+    MsgPackDecoder() : resync(false) {
+        clear();
+    }
+    void clear();
+    /**
+     * Copy byte c to dst, up to dstEnd.
+     * Returns STATUS_OK when the top-level value is complete,
+     * STATUS_WAIT_EOL if more input is needed, STATUS_WAIT_IDLE if c was
+     * dropped to resynchronize, or an error status.
+     */
+    Status decode(uint8_t c, char *&dst, char *dstEnd);
+} MsgPackDecoder;
+
+/**
+ * Builds a JSON tree directly from MessagePack held in a buffer, so that
+ * tokenized commands need no text parsing. Strings are terminated in place
+ * over their MessagePack headers, so the buffer must outlive the tree.
+ */
+typedef class MsgPackReader {
+private:
+    char *pos;
+    char *end;
+    uint8_t depth;
+
+private:
+    bool readBytes(uint8_t n, uint32_t &value);
+    Status readLength(uint8_t c, uint16_t &n);
+    Status readString(uint16_t len, const char *&str);
+    Status readItem(JsonArray *pjarr, JsonObject *pjobj, const char *key);
+    Status readArray(JsonArray &jarr, uint16_t n);
+    Status readObject(JsonObject &jobj, uint16_t n);
+
+public:
+    MsgPackReader(char *buf, size_t length)
+        : pos(buf), end(buf + length), depth(0) {}
+    /**
+     * Return true if the buffer holds a top-level MessagePack map
+     */
+    bool isObject();
+    Status read(JsonArray &jarr);
+    Status read(JsonObject &jobj);
+} MsgPackReader;
+
+} // namespace firestep
+
+#endif
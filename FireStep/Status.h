@@ -51,6 +51,7 @@ enum Status {
     STATUS_PROBE_PIN = -139,		// No probe pin specified
     STATUS_KINEMATIC_XYZ = -140,	// Could not solve XYZ cartesian kinematics
     STATUS_USER_EEPROM = -141,		// user EEPROM address out of range [2000,EEPROM_END)
+    STATUS_EEPROM_CONFIG = -143,	// Configuration image missing, corrupt or stale
 
     // stroke
     STATUS_STROKE_SEGPULSES = -200,	// Stroke has too many pulses per segment [-127,127]
@@ -32,16 +32,19 @@ void Stroke::clear() {
     scale = 1;
     curSeg = 0;
     tStart = 0;
+    started = false;
     dtTotal = 0;
     dPos = dEndPos = Quad<StepCoord>();
     vPeak = 0;
+    pOffset = NULL;
+    offset = Quad<StepCoord>();
 }
 
 SegIndex Stroke::goalSegment(Ticks t) {
-    if (t < tStart || length == 0 || dtTotal == 0) {
+    Ticks dt = ticksElapsed(t, tStart);
+    if (dt < 0 || length == 0 || dtTotal == 0) {
         return 0;
     }
-    Ticks dt = t - tStart;
     if (dt >= dtTotal) {
         return length - 1;
     }
@@ -50,10 +53,10 @@ SegIndex Stroke::goalSegment(Ticks t) {
 }
 
 Ticks Stroke::goalStartTicks(Ticks t) {
-    if (t < tStart || length == 0 || dtTotal == 0) {
+    Ticks dt = ticksElapsed(t, tStart);
+    if (dt < 0 || length == 0 || dtTotal == 0) {
         return 0;
     }
-    Ticks dt = t - tStart;
     if (dt >= dtTotal) {
         return (dtTotal * (length - 1)) / length;
     }
@@ -65,10 +68,10 @@ Ticks Stroke::goalStartTicks(Ticks t) {
 }
 
 Ticks Stroke::goalEndTicks(Ticks t) {
-    if (t < tStart || length == 0 || dtTotal == 0) {
+    Ticks dt = ticksElapsed(t, tStart);
+    if (dt < 0 || length == 0 || dtTotal == 0) {
         return 0;
     }
-    Ticks dt = t - tStart;
     if (dt >= dtTotal) {
         return dtTotal;
     }
@@ -85,7 +88,7 @@ Quad<StepCoord> Stroke::goalPos(Ticks t) {
     Ticks dtSegStart = goalStartTicks(t);
     Ticks dtSegEnd = goalEndTicks(t);
     Ticks dtSeg = dtSegEnd - dtSegStart;
-    Ticks dt = t - tStart;
+    Ticks dt = ticksElapsed(t, tStart);
     if (dt <= 0 || dtTotal <= 0 || length <= 0 || dtSeg <= 0) {
         // do nothing
     } else if (dtTotal <= dt && !dEndPos.isZero()) {
@@ -116,6 +119,7 @@ template<class T> T abs(T a) {
 
 Status Stroke::start(Ticks tStart) {
     this->tStart = tStart;
+    started = true;
 
     if (dtTotal <= 0) {
 		TESTCOUT1("Stroke::start dtTotal:", dtTotal);
@@ -124,9 +128,9 @@ Status Stroke::start(Ticks tStart) {
 
     dPos = 0;
     if (dEndPos.isZero()) {
-        dEndPos = goalPos(tStart + dtTotal);
+        dEndPos = goalPos((Ticks)((uint32_t) tStart + dtTotal));
     } else {
-        Quad<StepCoord> almostEnd = goalPos(tStart + dtTotal - 1);
+        Quad<StepCoord> almostEnd = goalPos((Ticks)((uint32_t) tStart + dtTotal - 1));
         for (QuadIndex i = 0; i < 4; i++) {
             if (STROKE_MAX_END_PULSES < abs(dEndPos.value[i] - almostEnd.value[i])) {
                 TESTCOUT4("Stroke::start() STATUS_STROKE_END_ERROR dEndPos[", (int)i,
@@ -138,24 +142,109 @@ Status Stroke::start(Ticks tStart) {
         }
     }
     TESTCOUT2("Stroke::start() dEndPos:", dEndPos.toString(), " dtTotal:", dtTotal);
+    if (pOffset) {
+        startOffset();
+    }
     return STATUS_OK;
 }
 
+void Stroke::startOffset() {
+    offset = Quad<StepCoord>();
+    offsetSeg = 0;
+    for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+        offsetVelocity.value[i] = seg[0].value[i];
+    }
+    offsetPlanEnd = length > 1 ? offsetVelocity * scale : dEndPos;
+    offsetStart = Quad<StepCoord>();
+    offsetEnd = pOffset->strokeOffset(offsetPlanEnd);
+    slopeOffset();
+}
+
+/**
+ * Cache the tick range of offsetSeg and the 16.16 fixed-point offset
+ * slope across it, so that goalOffset() needs no division within a segment
+ */
+void Stroke::slopeOffset() {
+    offsetDtStart = (offsetSeg * dtTotal) / length;
+    offsetDtNext = ((offsetSeg + 1) * dtTotal) / length; // goalSegment() changes here
+    Ticks dtSeg = offsetDtNext - offsetDtStart;
+    if (offsetSeg == length - 1) {
+        offsetDtNext = dtTotal;
+    }
+    if (dtSeg <= 0) {
+        offsetStart = offsetEnd;
+    }
+    for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+        int32_t range = (int32_t) offsetEnd.value[i] - offsetStart.value[i];
+        range = max((int32_t) -32767, min((int32_t) 32767, range));
+        offsetSlope.value[i] = dtSeg <= 0 ? 0 : (range << 16) / dtSeg;
+    }
+}
+
+/**
+ * Offset at time t, interpolated between the offsets at the boundaries of
+ * the goal segment. Boundary offsets are only requested when the goal
+ * segment changes, so the planned segment positions are accumulated here
+ * rather than summed from the stroke start. Within a segment the offset
+ * costs one multiply per axis.
+ */
+Quad<StepCoord> Stroke::goalOffset(Ticks t) {
+    Ticks dt = ticksElapsed(t, tStart);
+    if (dt <= 0 || dtTotal <= 0 || length <= 0) {
+        return offsetStart;
+    }
+    if (dt >= offsetDtNext) {
+        SegIndex sGoal = goalSegment(t);
+        if (sGoal > offsetSeg) {
+            bool adjacent = sGoal == offsetSeg + 1;
+            Quad<StepCoord> planStart;
+            while (offsetSeg < sGoal) {
+                planStart = offsetPlanEnd;
+                offsetSeg++;
+                for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+                    offsetVelocity.value[i] += seg[offsetSeg].value[i];
+                    offsetPlanEnd.value[i] += offsetVelocity.value[i] * scale;
+                }
+            }
+            if (offsetSeg == length - 1) {
+                offsetPlanEnd = dEndPos;
+            }
+            offsetStart = adjacent ? offsetEnd : pOffset->strokeOffset(planStart);
+            offsetEnd = pOffset->strokeOffset(offsetPlanEnd);
+            slopeOffset();
+        }
+        if (dt >= dtTotal) {
+            return offsetEnd;
+        }
+    }
+    Ticks tNum = dt - offsetDtStart;
+    Quad<StepCoord> dOffset;
+    for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+        dOffset.value[i] = offsetStart.value[i] +
+                           (StepCoord)((tNum * offsetSlope.value[i] + 0x8000L) >> 16);
+    }
+    return dOffset;
+}
+
 bool Stroke::isDone() {
-    return dPos == dEndPos;
+    return dPos == dEndPos + offset;
 }
 
 Status Stroke::traverse(Ticks tCurrent, QuadStepper &stepper) {
-    Quad<StepCoord> dGoal = goalPos(tCurrent);
-    if (tStart <= 0) {
+    if (!started) {
         return STATUS_STROKE_START;
     }
+    Quad<StepCoord> dGoal = goalPos(tCurrent);
 #ifdef TEST
-    Ticks endTicks = tCurrent - (tStart + dtTotal);
+    Ticks endTicks = ticksElapsed(tCurrent, tStart) - dtTotal;
     if (endTicks > -5) {
         TESTCOUT2("traverse(", endTicks, ") ", dGoal.toString());
     }
 #endif
+    if (pOffset) {
+        offset = goalOffset(tCurrent);
+        dGoal += offset;
+    }
 
     Status status = STATUS_BUSY_MOVING;
     Quad<StepDV> pulse;
@@ -189,7 +278,7 @@ Status Stroke::traverse(Ticks tCurrent, QuadStepper &stepper) {
             return status;
         }
     }
-    if (tCurrent >= tStart + dtTotal) {
+    if (ticksElapsed(tCurrent, tStart) >= dtTotal) {
         TESTCOUT3("Stroke::traverse() tCurrent:", tCurrent, " tStart:", tStart, " dtTotal:", dtTotal);
         return STATUS_OK;
     }
@@ -210,7 +299,7 @@ int16_t Stroke::append(Quad<StepDV> dv) {
 StrokeBuilder::StrokeBuilder(int32_t vMax, float vMaxSeconds,
                              int16_t minSegments, int16_t maxSegments)
     : vMax(vMax), vMaxSeconds(vMaxSeconds),
-      minSegments(minSegments), maxSegments(maxSegments) {
+      minSegments(minSegments), maxSegments(maxSegments), scale(2) {
     if (maxSegments == 0 || STROKE_SEGMENTS <= maxSegments) {
         maxSegments = STROKE_SEGMENTS - 1;
     }
@@ -285,8 +374,7 @@ Status StrokeBuilder::buildLine(Stroke & stroke, Quad<StepCoord> relPos) {
     stroke.clear();
     stroke.setTimePlanned(tS);
     stroke.length = N;
-#define SCALE 2
-    stroke.scale = SCALE;
+    stroke.scale = scale;
     PH5TYPE E[STROKE_SEGMENTS + 1];
     E[0] = phfMax.Ekt(0, 0);
     for (int16_t iSeg = 1; iSeg <= N; iSeg++) {
@@ -303,10 +391,10 @@ Status StrokeBuilder::buildLine(Stroke & stroke, Quad<StepCoord> relPos) {
                 stroke.dEndPos.value[i] = pos < 0 ? pos - 0.5 : pos + 0.5;
                 TESTCOUT2("dEndPos.value[", (int) i, "] ", stroke.dEndPos.value[i]);
             }
-            pos /= SCALE;
+            pos /= scale;
             StepCoord sNew = pos < 0 ? pos - 0.5 : pos + 0.5;
             StepCoord vNew = sNew - s;
-            stroke.vPeak = max(stroke.vPeak, (int32_t)abs(vNew*SCALE));
+            stroke.vPeak = max(stroke.vPeak, (int32_t)abs(vNew*scale));
             StepCoord dv = vNew - v;
             //TESTCOUT4("iSeg:", iSeg, " sNew:", sNew, " vNew:", vNew, " dv:", dv);
             if (dv < (StepCoord) - 127 || (StepCoord) 127 < dv) {
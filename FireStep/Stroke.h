@@ -28,11 +28,19 @@ public:
     virtual Status stepFast(Quad<StepDV> &pulse) = 0;
 } QuadStepper;
 
+typedef class StrokeOffset {
+public:
+    // Offset from the planned stroke position dPos, relative to the stroke start.
+    // Called at segment boundaries; offsets are interpolated within a segment.
+    virtual Quad<StepCoord> strokeOffset(const Quad<StepCoord> &dPos) = 0;
+} StrokeOffset;
+
 typedef class Stroke {
     friend class StrokeBuilder;
 private:
     Quad<StepCoord> dPos;				// current offset from start position
     Ticks			dtTotal;			// ticks for planned traversal
+    bool			started;			// start() has been called
 public:
     Ticks			tStart;				// ticks at start of traversal
     int32_t			vPeak;				// peak velocity on any axis
@@ -41,10 +49,24 @@ public:
     SegIndex	 	length;				// number of segments
     Quad<StepDV> 	seg[STROKE_SEGMENTS];	// delta velocity
     Quad<StepCoord>	dEndPos;			// ending offset
+    StrokeOffset *	pOffset;			// traversal position offsets (NULL: none)
+    Quad<StepCoord>	offset;				// position offset applied by last traverse()
+private:
+    SegIndex		offsetSeg;			// segment of offsetStart and offsetEnd
+    Quad<StepCoord>	offsetVelocity;		// planned velocity of offsetSeg
+    Quad<StepCoord>	offsetPlanEnd;		// planned position at end of offsetSeg
+    Quad<StepCoord>	offsetStart;		// offset at start of offsetSeg
+    Quad<StepCoord>	offsetEnd;			// offset at end of offsetSeg
+    Quad<int32_t>	offsetSlope;		// 16.16 offset pulses per tick across offsetSeg
+    Ticks			offsetDtStart;		// ticks from tStart to start of offsetSeg
+    Ticks			offsetDtNext;		// ticks from tStart to end of offsetSeg
+    void slopeOffset();
+    Quad<StepCoord> goalOffset(Ticks t);
 public:
     Stroke();
     void clear();
     Status start(Ticks tStart);
+    void startOffset();
     Status traverse(Ticks tCurrent, QuadStepper &quadStep);
     bool isDone();
     Quad<StepCoord> goalPos(Ticks t);
@@ -69,6 +91,7 @@ public:
     float 		vMaxSeconds; // seconds to achieve vMax
     int16_t		minSegments; // minimum number of stroke segments (default 20)
     int16_t		maxSegments; // maximum number of stroke segments (defuault 50);
+    StepCoord	scale; // segment velocity unit (default 2)
 
 public:
     StrokeBuilder(int32_t vMax = 12800, float vMaxSeconds = 0.5,
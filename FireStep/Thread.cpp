@@ -3,16 +3,14 @@
 
 using namespace firestep;
 
-#define MAX_THREADS 32
-
 namespace firestep {
-ThreadClock 	threadClock;
-ThreadRunner 	threadRunner;
-struct Thread *	pThreadList;
-int 			nThreads;
-int32_t 		nLoops;
-int32_t 		nTardies;
-int16_t			leastFreeRam = 32767;
+MCU_LOCAL ThreadClock 	threadClock;
+MCU_LOCAL ThreadRunner 	threadRunner;
+MCU_LOCAL struct Thread *	pThreadList;
+MCU_LOCAL int 			nThreads;
+MCU_LOCAL int32_t 		nLoops;
+MCU_LOCAL int32_t 		nTardies;
+MCU_LOCAL int16_t		leastFreeRam = 32767;
 };
 
 
@@ -35,6 +33,7 @@ void Thread::setup() {
         if (nThreads >= MAX_THREADS) {
             Error("SC", MAX_THREADS);
         }
+        threadRunner.schedule(this);
     }
 }
 
@@ -111,8 +110,8 @@ void MonitorThread::loop() {
         verbose = true;
     }
     for (ThreadPtr pThread = pThreadList; pThread; pThread = pThread->pNext) {
-        if (threadClock.generation > pThread->nextLoop.generation + 1 &&
-                pThread->nextLoop.generation > 0) {
+        int16_t lag = threadClock.generation - pThread->nextLoop.generation;
+        if (lag > 1 && pThread->nextLoop.ticks != 0) {
             //cout << "ticks:" << threadClock.ticks
             //<< " nextLoop:" << pThread->nextLoop.ticks
             //<< " pThread:" << pThread->id << endl;
@@ -135,7 +134,7 @@ void MonitorThread::loop() {
 #endif
 }
 
-MonitorThread firestep::monitor;
+MCU_LOCAL MonitorThread firestep::monitor;
 
 void firestep::Error(const char *msg, int value) {
     monitor.Error(msg, value);
@@ -155,13 +154,15 @@ void ThreadRunner::clear() {
     lastAge = 0;
     age = 0;
     nHB = 0;
-    testTardies = 0;
     fast = 255;
+    nTimed = 0;
+    nAsap = 0;
     TIMER_CLEAR();
 }
 
 void ThreadRunner::setup(int pinLED) {
     monitor.setup(pinLED);
+    rebuild();
 
     TIMER_SETUP();
     lastAge = 0;
@@ -169,14 +170,87 @@ void ThreadRunner::setup(int pinLED) {
 }
 
 /**
- * The generation count has exceeded the maximum.
- * Give the machine a rest and power-cycle it.
+ * Add an active thread to the run queue according to its nextLoop
  */
-void ThreadRunner::resetGenerations() {
-    threadClock.ticks = 0;
-    lastAge = 0;
+void ThreadRunner::schedule(ThreadPtr pThread) {
+    if (nTimed + nAsap >= MAX_THREADS) {
+        return; // reported by Thread::setup()
+    }
+    if (pThread->nextLoop.ticks == 0) {
+        pushAsap(pThread);
+    } else {
+        pushTimed(pThread);
+    }
+}
+
+/**
+ * Reset the loop() profile of all threads
+ */
+void ThreadRunner::clearProfile() {
     for (ThreadPtr pThread = pThreadList; pThread; pThread = pThread->pNext) {
-        pThread->nextLoop.ticks = 0;
+        pThread->runMax = 0;
+        pThread->runTicks = 0;
+        pThread->runCount = 0;
+    }
+}
+
+/**
+ * Rebuild the run queue from pThreadList
+ */
+void ThreadRunner::rebuild() {
+    nTimed = 0;
+    nAsap = 0;
+    for (ThreadPtr pThread = pThreadList; pThread; pThread = pThread->pNext) {
+        schedule(pThread);
+    }
+}
+
+void ThreadRunner::pushTimed(ThreadPtr pThread) {
+    byte i = nTimed++;
+    while (i > 0) {
+        byte parent = (i - 1) / 2;
+        if (!runsBefore(pThread, queue[parent])) {
+            break;
+        }
+        queue[i] = queue[parent];
+        i = parent;
+    }
+    queue[i] = pThread;
+}
+
+ThreadPtr ThreadRunner::popTimed() {
+    ThreadPtr result = queue[0];
+    ThreadPtr pLast = queue[--nTimed];
+    byte i = 0;
+    for (;;) {
+        byte child = 2 * i + 1;
+        if (child >= nTimed) {
+            break;
+        }
+        if (child + 1 < nTimed && runsBefore(queue[child + 1], queue[child])) {
+            child++;
+        }
+        if (!runsBefore(queue[child], pLast)) {
+            break;
+        }
+        queue[i] = queue[child];
+        i = child;
+    }
+    queue[i] = pLast;
+    return result;
+}
+
+void ThreadRunner::pushAsap(ThreadPtr pThread) {
+    byte i = nAsap++;
+    for (; i > 0 && asap(i - 1)->priority < pThread->priority; i--) {
+        asap(i) = asap(i - 1);
+    }
+    asap(i) = pThread;
+}
+
+void ThreadRunner::removeAsap(byte i) {
+    for (nAsap--; i < nAsap; i++) {
+        asap(i) = asap(i + 1);
     }
 }
 
@@ -196,12 +270,7 @@ void firestep::ThreadEnable(boolean enable) {
 
 firestep::Ticks firestep::ticks() {
 #if defined(TEST)
-    arduino.timer1(1);
+    arduino.timerRead();
 #endif
-    Ticks result = threadRunner.ticks();
-
-    if (result == 0) {
-        result = threadRunner.ticks();
-    }
-    return result;
+    return threadRunner.ticks();
 }
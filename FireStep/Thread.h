@@ -5,10 +5,20 @@
 
 namespace firestep {
 
-extern int16_t leastFreeRam;
+extern MCU_LOCAL int16_t leastFreeRam;
+
+#define MAX_THREADS 32
 
 typedef int32_t Ticks;
 
+/**
+ * Ticks from tStart to t. Ticks wrap around, so they should only be
+ * compared by their difference, which is valid for spans under 2^31 ticks.
+ */
+inline Ticks ticksElapsed(Ticks t, Ticks tStart) {
+    return (Ticks)((uint32_t) t - (uint32_t) tStart);
+}
+
 typedef union ThreadClock  {
     Ticks ticks;
     struct {
@@ -18,11 +28,11 @@ typedef union ThreadClock  {
     ThreadClock() : ticks(0) {}
 } ThreadClock, *ThreadClockPtr;
 
-extern ThreadClock threadClock;
+extern MCU_LOCAL ThreadClock threadClock;
 
 typedef struct Thread {
 public:
-    Thread() : tardies(0), id(0), pNext(NULL) {
+    Thread() : tardies(0), id(0), priority(0), runMax(0), runTicks(0), runCount(0), pNext(NULL) {
         nextLoop.ticks = 0;
     }
     virtual void setup();
@@ -36,6 +46,12 @@ public:
 
     byte tardies;
     char id;
+    byte priority; // threads due at the same time run highest priority first
+
+    // loop() profile in timer ticks, measured by ThreadRunner
+    uint16_t runMax; // longest loop()
+    uint32_t runTicks; // total time in loop()
+    uint32_t runCount; // loop() calls
 }
 Thread, *ThreadPtr;
 
@@ -74,26 +90,56 @@ public:
 void Error(const char *msg, int value);
 void ThreadEnable(boolean enable);
 
-extern MonitorThread monitor;
+extern MCU_LOCAL MonitorThread monitor;
 
-extern struct Thread *pThreadList;
-extern int nThreads;
-extern int32_t nLoops;
-extern int32_t nTardies;
+extern MCU_LOCAL struct Thread *pThreadList;
+extern MCU_LOCAL int nThreads;
+extern MCU_LOCAL int32_t nLoops;
+extern MCU_LOCAL int32_t nTardies;
 
 typedef class ThreadRunner {
 private:
     uint16_t 	generation;
     uint16_t 	lastAge;
     uint16_t 	age;
-    byte		testTardies;
     int16_t		nHB;
     byte		fast;
+    // Timed threads are a min-heap on nextLoop growing up from queue[0].
+    // ASAP threads (nextLoop 0) grow down from queue[MAX_THREADS-1].
+    ThreadPtr	queue[MAX_THREADS];
+    byte		nTimed;
+    byte		nAsap;
+
+private:
+    inline ThreadPtr &asap(byte i) {
+        return queue[MAX_THREADS - 1 - i];
+    }
+    inline static bool runsBefore(ThreadPtr a, ThreadPtr b) {
+        Ticks dt = ticksElapsed(a->nextLoop.ticks, b->nextLoop.ticks);
+        return dt < 0 || (dt == 0 && a->priority > b->priority);
+    }
+    void pushTimed(ThreadPtr pThread);
+    ThreadPtr popTimed();
+    void pushAsap(ThreadPtr pThread);
+    void removeAsap(byte i);
+    void rebuild();
+    inline void run(ThreadPtr pThread) {
+        uint16_t tStart = TIMER_VALUE();
+        pThread->loop();
+        uint16_t tRun = (uint16_t) TIMER_VALUE() - tStart; // wrap-safe
+        pThread->runTicks += tRun;
+        pThread->runCount++;
+        if (tRun > pThread->runMax) {
+            pThread->runMax = tRun;
+        }
+        nHB++;
+    }
 public:
     ThreadRunner();
-    void resetGenerations();
     void clear();
     void setup(int pinLED = NOPIN);
+    void schedule(ThreadPtr pThread);
+    void clearProfile();
 
 public:
     void run() {
@@ -115,8 +161,8 @@ public:
         return age;
     }
 public:
-    inline byte get_testTardies() {
-        return testTardies;
+    inline byte get_scheduled() {
+        return nTimed + nAsap;
     }
 public:
     inline void outerLoop() {
@@ -135,66 +181,54 @@ public:
         if (age < lastAge) {
             // 1) a generation is 4.194304s
             // 2) generation is incremented when TIMER_VALUE() overflows
-            // 3) innerLoop MUST complete within a generation
-            lastAge = age;
+            // 3) ticks() MUST be called at least once per generation
+            // 4) generation wraps with ticks every ~76 hours
             threadClock.generation = ++generation;
-            if (generation > MAX_GENERATIONS) {
-                // TODO test this
-                // generation overflow every ~58 hours
-                resetGenerations();
-                //const char *msg ="GOVFL";
-                //Serial.println(msg);
-                //throw msg;
-            }
-            sei();
-            return 0;
         }
         lastAge = age;
         sei();
         return threadClock.ticks;
     }
     inline byte innerLoop() {
-        if (ticks() == 0) {
-            return 0;
-        }
-
-        // inner loop: run active Threads
-        for (ThreadPtr pThread = pThreadList; pThread; pThread = pThread->pNext) {
-            if (generation < pThread->nextLoop.generation) {
-                continue; // not time yet for scheduled reactivation
-            }
-            if (generation == pThread->nextLoop.generation && age < pThread->nextLoop.age) {
-                continue; // not time yet for scheduled reactivation
+        ticks();
+
+        // inner loop: ASAP threads run on every pass
+        for (byte i = 0; i < nAsap; ) {
+            ThreadPtr pThread = asap(i);
+            run(pThread);
+            if (pThread->nextLoop.ticks) {
+                removeAsap(i);
+                pushTimed(pThread);
+            } else {
+                i++;
             }
+        }
 
-            pThread->loop();	// reactivate thread
-            nHB++;
-
-            if (testTardies-- == 0) {
-                testTardies = 5;	// test intermittently for late Threads
-                if (age <= pThread->nextLoop.age) {
-                    continue;    // transient ASAP or future
-                }
-                if (generation < pThread->nextLoop.generation) {
-                    continue;    // future
+        // timed threads run when due, earliest first
+        Ticks now = threadClock.ticks;
+        for (byte n = nTimed; n && ticksElapsed(now, queue[0]->nextLoop.ticks) >= 0; n--) {
+            ThreadPtr pThread = popTimed();
+            run(pThread);	// reactivate thread
+
+            if (pThread->nextLoop.ticks == 0) {
+                pushAsap(pThread);
+            } else {
+                if (ticksElapsed(pThread->nextLoop.ticks, now) < 0) {
+                    pThread->tardies++;	// thread-specific tardy count
+                    nTardies++;			// global tardy count
                 }
-                if (0 == pThread->nextLoop.age) {
-                    continue;    // permanent ASAP
-                }
-
-                pThread->tardies++;	// thread-specific tardy count
-                nTardies++;			// global tardy count
+                pushTimed(pThread);
             }
         }
         return 1;
     }
 } ThreadRunner;
-extern ThreadRunner threadRunner;
+extern MCU_LOCAL ThreadRunner threadRunner;
 
 /**
  * With the standard ATMEGA 16,000,000 Hz system clock and TCNT1 / 1024 prescaler:
  * 1 tick = 1024 clock cycles = 64 microseconds
- * Clock overflows in 2^31 * 0.000064 seconds = ~38.1 hours
+ * Clock wraps in 2^32 * 0.000064 seconds = ~76.3 hours (see ticksElapsed())
  */
 extern Ticks ticks();
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 #include <stdint.h>
 #include "../ArduinoJson/include/ArduinoJson/Arduino/Print.hpp"
 
@@ -103,7 +104,7 @@ int16_t digitalRead(int16_t dirPin);
 void pinMode(int16_t pin, int16_t inout);
 void delay(int ms);
 
-extern SerialType Serial;
+extern thread_local SerialType Serial;
 
 #define ARDUINO_PINS 127
 #define ARDUINO_MEM 1024
@@ -125,6 +126,19 @@ extern SerialType Serial;
 #define A14 (A13+1)
 #define A15 (A14+1)
 
+typedef struct PinEvent {
+    uint32_t cycles; // low 32 bits of MockDuino cycle count
+    uint8_t pin;
+    uint8_t level;
+} PinEvent;
+
+typedef struct PinTrigger {
+    int16_t pulsePin; // step pin whose pulse count fires the trigger
+    uint32_t pulses; // pulse count at which pin is set
+    int16_t pin;
+    int16_t level;
+} PinTrigger;
+
 typedef class MockDuino {
 	friend void delayMicroseconds(uint16_t us);
 	friend void digitalWrite(int16_t pin, int16_t value);
@@ -138,6 +152,21 @@ typedef class MockDuino {
 		int32_t pinPulses[ARDUINO_PINS];
         int16_t mem[ARDUINO_MEM];
 		int32_t usDelay;
+		uint64_t cycleCount; // virtual CPU cycles
+		int32_t cyclePrescale; // cycles not yet counted by TCNT1
+		bool cycleClock; // TCNT1 driven by cycleCount
+		vector<PinEvent> traceBuf; // pin event ring buffer
+		size_t traceHead; // index of oldest event
+		size_t traceCount;
+		uint8_t tracePins[(ARDUINO_PINS+7)/8]; // pin filter bit set
+		bool tracing;
+		vector<PinTrigger> triggers; // pending pin changes
+		inline void trace(int16_t pin, int16_t level) {
+			if (tracing && (tracePins[pin>>3] & (1<<(pin&7)))) {
+				traceAdd(pin, level);
+			}
+		}
+		void traceAdd(int16_t pin, int16_t level);
     public:
 
     public:
@@ -146,10 +175,23 @@ typedef class MockDuino {
 		int16_t& MEM(int addr);
 		void clear();
 		void timer1(int increment=1);
+		void timerRead();
+		void cycles(int32_t n);
+		void useCycleClock(bool enable=true);
+		uint64_t get_cycles() {return cycleCount;}
+		void pulseFast(int16_t pin);
+		void tracePin(int16_t pin, bool enable=true);
+		void traceStart(size_t capacity);
+		void traceStop();
+		size_t traceSize() {return traceCount;}
+		PinEvent traceEvent(size_t i);
+		void traceWrite(ostream &out);
+		void traceVCD(ostream &out);
 		void delay500ns();
 		int16_t getPinMode(int16_t pin);
 		int16_t getPin(int16_t pin);
 		void setPin(int16_t pin, int16_t value);
+		void triggerPin(int16_t pulsePin, uint32_t pulses, int16_t pin, int16_t value);
 		void setPinMode(int16_t pin, int16_t value);
 		uint32_t pulses(int16_t pin);
 		uint32_t get_usDelay() {return usDelay;}
@@ -157,6 +199,14 @@ typedef class MockDuino {
 
 #define DELAY500NS arduino.delay500ns();
 
-extern MockDuino arduino;
+// Modeled ATmega2560 cycle costs charged to the MockDuino virtual clock
+#define CYCLES_DIGITALWRITE	56	// Arduino digitalWrite()
+#define CYCLES_PULSEFAST	24	// pulseFast() port access without STEPPER_PULSE_DELAY
+#define CYCLES_DELAY500NS	8	// DELAY500NS nops
+#define CYCLES_TIMERREAD	20	// ticks() read of TCNT1
+#define CYCLES_PER_US		16	// delayMicroseconds()
+#define CYCLES_SERIAL_WRITE	60	// HardwareSerial::write() of one byte to the transmit buffer
+
+extern thread_local MockDuino arduino;
 
 #endif
@@ -34,7 +34,7 @@ using namespace std;
 
 FILE *logFile = NULL;
 int logLevel = FIRELOG_WARN;
-static char lastMessage[5][LOGMAX+1];
+static thread_local char lastMessage[5][LOGMAX+1];
 
 static class Singleton {
 	public: Singleton() {};
@@ -124,10 +124,11 @@ void firelog(const char *msg, int level) {
     timeval tp;
     gettimeofday(&tp, 0);
     time_t curtime = tp.tv_sec;
-    struct tm *pLocalNow = localtime(&curtime);
-    int now_hour = pLocalNow->tm_hour;
-    int now_min = pLocalNow->tm_min;
-    int now_sec = pLocalNow->tm_sec;
+    struct tm localNow;
+    localtime_r(&curtime, &localNow); // simulated machines may log from several threads
+    int now_hour = localNow.tm_hour;
+    int now_min = localNow.tm_min;
+    int now_sec = localNow.tm_sec;
     int now_ms = tp.tv_usec/1000;
 #endif
     int tid = 0;
@@ -179,7 +180,8 @@ static struct tm tmLocalNow() {
     timeval tp;
     gettimeofday(&tp, 0);
     time_t curtime = tp.tv_sec;
-    return *localtime(&curtime);
+    struct tm localNow;
+    return *localtime_r(&curtime, &localNow);
 }
 
 static struct tm tmStart = tmLocalNow();
@@ -7,10 +7,12 @@
 #include "Arduino.h"
 #include "Thread.h"
 
-SerialType Serial;
-MockDuino arduino;
-vector<uint8_t> serialbytes;
-int16_t eeprom_data[EEPROM_END];
+// Each host thread has its own simulated MCU
+thread_local SerialType Serial;
+thread_local MockDuino arduino;
+thread_local vector<uint8_t> serialbytes;
+thread_local int16_t eeprom_data[EEPROM_END];
+thread_local int32_t eeprom_write_count; // EEPROM wear
 
 
 void SerialType::clear() {
@@ -78,6 +80,7 @@ byte SerialType::read() {
 }
 
 size_t SerialType::write(uint8_t value) {
+    arduino.cycles(CYCLES_SERIAL_WRITE);
     serialout.append(1, (char) value);
 	if (value == '\r') {
 		serialline.append(1, '\\');
@@ -96,11 +99,13 @@ void SerialType::print(const char value) {
 	char buf[2];
 	buf[0] = value;
 	buf[1] = 0;
+    arduino.cycles(CYCLES_SERIAL_WRITE);
     serialout.append(buf);
     serialline.append(buf);
 }
 
 void SerialType::print(const char *value) {
+    arduino.cycles(CYCLES_SERIAL_WRITE * strlen(value));
     serialout.append(value);
     serialline.append(value);
 }
@@ -118,6 +123,7 @@ void SerialType::print(int value, int format) {
         break;
     }
     string bufVal = buf.str();
+    arduino.cycles(CYCLES_SERIAL_WRITE * bufVal.size());
     serialline.append(bufVal);
     serialout.append(bufVal);
 }
@@ -160,8 +166,18 @@ void MockDuino::clear() {
 	for (int16_t i=0; i<EEPROM_END; i++) {
 		eeprom_data[i] = NOVALUE;
 	}
+	eeprom_write_count = 0;
     memset(pinPulses, 0, sizeof(pinPulses));
     usDelay = 0;
+    cycleCount = 0;
+    cyclePrescale = 0;
+    cycleClock = false;
+    tracing = false;
+    traceBuf.clear();
+    traceHead = 0;
+    traceCount = 0;
+    memset(tracePins, 0, sizeof(tracePins));
+    triggers.clear();
     ADCSRA = 0;	// ADC control and status register A (disabled)
     TCNT1 = 0; 	// Timer/Counter1
     CLKPR = 0;	// Clock prescale register
@@ -199,14 +215,186 @@ void MockDuino::dump() {
 void MockDuino::timer1(int increment) {
     if (TIMER_ENABLED) {
         TCNT1 += increment;
+        cycleCount += (int64_t) increment * TIMER_PRESCALE;
+    }
+}
+
+/**
+ * Firmware read of TCNT1 by ticks(). Without the cycle clock each read
+ * advances TCNT1 by one tick; with it, each read costs CYCLES_TIMERREAD.
+ */
+void MockDuino::timerRead() {
+    if (cycleClock) {
+        cycles(CYCLES_TIMERREAD);
+    } else {
+        timer1(1);
+    }
+}
+
+/**
+ * Charge n CPU cycles to the virtual clock
+ */
+void MockDuino::cycles(int32_t n) {
+    cycleCount += n;
+    if (cycleClock && TIMER_ENABLED) {
+        cyclePrescale += n;
+        TCNT1 += cyclePrescale / TIMER_PRESCALE;
+        cyclePrescale %= TIMER_PRESCALE;
+    }
+}
+
+/**
+ * Drive TCNT1 from modeled cycle costs instead of explicit timer1() calls
+ */
+void MockDuino::useCycleClock(bool enable) {
+    cycleClock = enable;
+    cyclePrescale = 0;
+}
+
+void MockDuino::pulseFast(int16_t pin) {
+    ASSERT(0 <= pin && pin < ARDUINO_PINS);
+    ASSERTEQUAL(OUTPUT, getPinMode(pin));
+    cycles(CYCLES_PULSEFAST);
+    this->pin[pin] = HIGH;
+    trace(pin, HIGH);
+    STEPPER_PULSE_DELAY;
+    this->pin[pin] = LOW;
+    trace(pin, LOW);
+    pinPulses[pin]++;
+    for (size_t i = 0; i < triggers.size(); ) {
+        PinTrigger &t(triggers[i]);
+        if (t.pulsePin == pin && t.pulses == (uint32_t) pinPulses[pin]) {
+            this->pin[t.pin] = t.level;
+            triggers.erase(triggers.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * Set pin to value when pulsePin has been pulsed the given number of times.
+ * Simulates sensors such as probes that trip at a position.
+ */
+void MockDuino::triggerPin(int16_t pulsePin, uint32_t pulses, int16_t pin, int16_t value) {
+    ASSERT(0 <= pulsePin && pulsePin < ARDUINO_PINS);
+    ASSERT(0 <= pin && pin < ARDUINO_PINS);
+    PinTrigger t = { pulsePin, pulses, pin, value };
+    triggers.push_back(t);
+}
+
+/**
+ * Include or exclude pin from the pulse trace
+ */
+void MockDuino::tracePin(int16_t pin, bool enable) {
+    ASSERT(0 <= pin && pin < ARDUINO_PINS);
+    if (enable) {
+        tracePins[pin>>3] |= 1<<(pin&7);
+    } else {
+        tracePins[pin>>3] &= ~(1<<(pin&7));
+    }
+}
+
+/**
+ * Record level changes of the traced pins in a ring buffer of the given
+ * capacity, which keeps the newest events. The current level of each
+ * traced pin is recorded first.
+ */
+void MockDuino::traceStart(size_t capacity) {
+    traceBuf.assign(capacity, PinEvent());
+    traceHead = 0;
+    traceCount = 0;
+    tracing = capacity > 0;
+    for (int16_t i = 0; i < ARDUINO_PINS; i++) {
+        if (pin[i] == HIGH || pin[i] == LOW) {
+            trace(i, pin[i]);
+        }
+    }
+}
+
+void MockDuino::traceStop() {
+    tracing = false;
+}
+
+void MockDuino::traceAdd(int16_t pin, int16_t level) {
+    size_t capacity = traceBuf.size();
+    PinEvent &event = traceBuf[(traceHead + traceCount) % capacity];
+    if (traceCount < capacity) {
+        traceCount++;
+    } else {
+        traceHead = (traceHead + 1) % capacity; // overwrite oldest
+    }
+    event.cycles = (uint32_t) cycleCount;
+    event.pin = pin;
+    event.level = level ? HIGH : LOW;
+}
+
+/**
+ * Return the i-th oldest trace event
+ */
+PinEvent MockDuino::traceEvent(size_t i) {
+    ASSERT(i < traceCount);
+    return traceBuf[(traceHead + i) % traceBuf.size()];
+}
+
+/**
+ * Write trace events oldest first as 6 little-endian bytes each:
+ * uint32_t cycles, uint8_t pin, uint8_t level
+ */
+void MockDuino::traceWrite(ostream &out) {
+    for (size_t i = 0; i < traceCount; i++) {
+        PinEvent event = traceEvent(i);
+        for (int b = 0; b < 32; b += 8) {
+            out.put((char)((event.cycles >> b) & 0xff));
+        }
+        out.put((char) event.pin);
+        out.put((char) event.level);
+    }
+}
+
+static string vcdId(int16_t pin) {
+    string id;
+    do {
+        id += (char)('!' + pin % 94);
+        pin /= 94;
+    } while (pin > 0);
+    return id;
+}
+
+/**
+ * Write trace events as a Value Change Dump for waveform viewers.
+ * Time is measured from the oldest event in 100ps units.
+ */
+void MockDuino::traceVCD(ostream &out) {
+    out << "$timescale 100ps $end" << endl;
+    out << "$scope module mockduino $end" << endl;
+    for (int16_t i = 0; i < ARDUINO_PINS; i++) {
+        if (tracePins[i>>3] & (1<<(i&7))) {
+            out << "$var wire 1 " << vcdId(i) << " pin" << i << " $end" << endl;
+        }
+    }
+    out << "$upscope $end" << endl;
+    out << "$enddefinitions $end" << endl;
+    uint64_t t = 0;
+    uint32_t cyclesLast = traceCount ? traceEvent(0).cycles : 0;
+    for (size_t i = 0; i < traceCount; i++) {
+        PinEvent event = traceEvent(i);
+        if (i == 0 || event.cycles != cyclesLast) {
+            t += (uint32_t)(event.cycles - cyclesLast); // unwrap
+            cyclesLast = event.cycles;
+            out << "#" << t * (10000000000LL / CLOCK_HZ) << endl;
+        }
+        out << (int) event.level << vcdId(event.pin) << endl;
     }
 }
 
 void MockDuino::delay500ns() {
+    cycles(CYCLES_DELAY500NS);
 }
 
 void delayMicroseconds(uint16_t usDelay) {
     arduino.usDelay += usDelay;
+    arduino.cycles((int32_t) usDelay * CYCLES_PER_US);
 }
 
 void analogWrite(int16_t pin, int16_t value) {
@@ -226,11 +414,13 @@ int16_t analogRead(int16_t pin) {
 void digitalWrite(int16_t pin, int16_t value) {
     ASSERT(0 <= pin && pin < ARDUINO_PINS);
     ASSERTEQUAL(OUTPUT, arduino.getPinMode(pin));
+    arduino.cycles(CYCLES_DIGITALWRITE);
     if (arduino.pin[pin] != value) {
         if (value == 0) {
             arduino.pinPulses[pin]++;
         }
         arduino.pin[pin] = value ? HIGH : LOW;
+        arduino.trace(pin, arduino.pin[pin]);
     }
 }
 
@@ -284,6 +474,25 @@ uint8_t eeprom_read_byte(uint8_t *addr) {
 void eeprom_write_byte(uint8_t *addr, uint8_t value) {
     if (0 <= (size_t) addr && (size_t) addr < EEPROM_END) {
         eeprom_data[(size_t) addr] = value;
+        eeprom_write_count++;
+    }
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+    if (eeprom_read_byte(addr) != value) {
+        eeprom_write_byte(addr, value);
+    }
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n) {
+    for (size_t i=0; i<n; i++) {
+        ((uint8_t *) dst)[i] = eeprom_read_byte((uint8_t *) src + i);
+    }
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n) {
+    for (size_t i=0; i<n; i++) {
+        eeprom_update_byte((uint8_t *) dst + i, ((const uint8_t *) src)[i]);
     }
 }
 
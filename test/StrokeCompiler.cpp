@@ -0,0 +1,182 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <sstream>
+#include "StrokeCompiler.h"
+
+using namespace std;
+using namespace firestep;
+
+StrokeCompiler::StrokeCompiler() : lineNum(0) {
+    opts.vMax = 12800;
+    opts.tvMax = 0.7;
+    opts.delta = false;
+    opts.travelMin = -32000;
+    opts.travelMax = 32000;
+    opts.relative = false;
+}
+
+void StrokeCompiler::setup() {
+    delta.setup();
+}
+
+void StrokeCompiler::compileError(const char *msg, const string &line) {
+    cerr << "ERROR\t: line " << lineNum << ": " << msg << ": " << line << endl;
+}
+
+/**
+ * Convert destination coordinates to motor pulses
+ */
+bool StrokeCompiler::motorPosition(PH5TYPE coord[QUAD_ELEMENTS], Quad<StepCoord> &pos) {
+    if (opts.delta) {
+        Step3D pulses(delta.calcPulses(XYZ3D(coord[0], coord[1], coord[2])));
+        if (!pulses.isValid()) {
+            return false;
+        }
+        pos.value[0] = pulses.p1;
+        pos.value[1] = pulses.p2;
+        pos.value[2] = pulses.p3;
+    } else {
+        for (QuadIndex i = 0; i < 3; i++) {
+            pos.value[i] = (StepCoord)(coord[i] < 0 ? coord[i] - 0.5 : coord[i] + 0.5);
+        }
+    }
+    pos.value[3] = (StepCoord)(coord[3] < 0 ? coord[3] - 0.5 : coord[3] + 0.5);
+    return true;
+}
+
+/**
+ * Build the stroke at the finest scale whose segment velocity changes fit
+ * in a StepDV
+ */
+Status StrokeCompiler::buildStroke(Stroke &stroke, Quad<StepCoord> dPos) {
+    StrokeBuilder sb(opts.vMax, opts.tvMax);
+    Status status = STATUS_STROKE_SEGPULSES;
+    for (int i = 0; i < COMPILE_SCALES && status == STATUS_STROKE_SEGPULSES; i++) {
+        sb.scale = 1 << i;
+        status = sb.buildLine(stroke, dPos);
+    }
+    return status;
+}
+
+void StrokeCompiler::writeStroke(ostream &out, Stroke &stroke) {
+    char buf[8];
+    out << "{\"dvs\":{\"us\":" << (int32_t)(stroke.getTimePlanned() * 1000000 + 0.5)
+        << ",\"sc\":" << stroke.scale;
+    for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+        out << ",\"" << (int)(i + 1) << "\":\"";
+        for (SegIndex s = 0; s < stroke.length; s++) {
+            snprintf(buf, sizeof(buf), "%02X", (uint8_t) stroke.seg[s].value[i]);
+            out << buf;
+        }
+        out << "\"";
+    }
+    out << ",\"dp\":[" << stroke.dEndPos.value[0] << "," << stroke.dEndPos.value[1]
+        << "," << stroke.dEndPos.value[2] << "," << stroke.dEndPos.value[3] << "]}}" << endl;
+}
+
+/**
+ * Parse one input line into coord. Returns 1 for a move, 0 for a line
+ * without a move and -1 on error.
+ */
+int StrokeCompiler::parseLine(string line, PH5TYPE coord[QUAD_ELEMENTS]) {
+    size_t comment = line.find_first_of(";(");
+    if (comment != string::npos) {
+        line = line.substr(0, comment);
+    }
+    for (size_t i = 0; i < line.size(); i++) {
+        line[i] = line[i] == ',' ? ' ' : toupper(line[i]);
+    }
+    istringstream iss(line);
+    string word;
+    if (!(iss >> word)) {
+        return 0;
+    }
+    if (word[0] != 'G') { // waypoint
+        istringstream wss(line);
+        PH5TYPE value;
+        int n = 0;
+        for (; n < QUAD_ELEMENTS && wss >> value; n++) {
+            coord[n] = opts.relative ? coord[n] + value : value;
+        }
+        return n >= 3 && (wss >> ws).eof() ? 1 : -1;
+    }
+    int g = atoi(word.c_str() + 1);
+    if (g == 90 || g == 91) {
+        opts.relative = g == 91;
+        return 0;
+    }
+    if (g != 0 && g != 1) {
+        return -1;
+    }
+    int moves = 0;
+    while (iss >> word) {
+        const char *axes = "XYZA";
+        const char *pAxis = strchr(axes, word[0]);
+        if (pAxis && word.size() > 1) {
+            PH5TYPE value = atof(word.c_str() + 1);
+            int i = pAxis - axes;
+            coord[i] = opts.relative ? coord[i] + value : value;
+            moves++;
+        } else if (word[0] != 'F') { // feed rate is set by -v and -t
+            return -1;
+        }
+    }
+    return moves ? 1 : 0;
+}
+
+int StrokeCompiler::compile(istream &in, ostream &out, PH5TYPE start[QUAD_ELEMENTS]) {
+    PH5TYPE coord[QUAD_ELEMENTS];
+    memcpy(coord, start, sizeof(coord));
+    Quad<StepCoord> curPos;
+    if (!motorPosition(coord, curPos)) {
+        cerr << "ERROR\t: start position has no delta solution" << endl;
+        return 1;
+    }
+    Stroke stroke;
+    int strokes = 0;
+    string line;
+    for (lineNum = 1; getline(in, line); lineNum++) {
+        int rc = parseLine(line, coord);
+        if (rc < 0) {
+            compileError("syntax", line);
+            return 1;
+        } else if (rc == 0) {
+            continue;
+        }
+        Quad<StepCoord> pos;
+        if (!motorPosition(coord, pos)) {
+            compileError("no delta solution", line);
+            return 1;
+        }
+        Quad<StepCoord> dPos;
+        for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+            if (pos.value[i] < opts.travelMin || opts.travelMax < pos.value[i]) {
+                compileError("axis travel limit", line);
+                return 1;
+            }
+            int32_t dp = (int32_t) pos.value[i] - curPos.value[i];
+            if (dp < -32767 || 32767 < dp) {
+                compileError("move too long", line);
+                return 1;
+            }
+            dPos.value[i] = dp;
+        }
+        if (dPos.isZero()) {
+            continue;
+        }
+        Status status = buildStroke(stroke, dPos);
+        if (status != STATUS_OK) {
+            char msg[40];
+            snprintf(msg, sizeof(msg), "buildLine status %d", status);
+            compileError(msg, line);
+            return 1;
+        }
+        writeStroke(out, stroke);
+        curPos = pos;
+        strokes++;
+    }
+    cerr << "STATUS\t: " << strokes << " strokes" << endl;
+    return 0;
+}
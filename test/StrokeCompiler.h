@@ -0,0 +1,53 @@
+#ifndef STROKECOMPILER_H
+#define STROKECOMPILER_H
+
+#include <iostream>
+#include <string>
+#include "Machine.h"
+
+namespace firestep {
+
+#define COMPILE_SCALES 4 // scales 1, 2, 4, 8
+
+typedef struct CompileOptions {
+    int32_t vMax;
+    float tvMax;
+    bool delta;
+    StepCoord travelMin;
+    StepCoord travelMax;
+    bool relative; // G91
+} CompileOptions;
+
+/**
+ * Trajectory compiler for firestepc. Plans each move with the firmware's own
+ * StrokeBuilder and emits it as a pre-encoded "dvs" command, one JSON
+ * line per stroke, so the device executes strokes without planning them.
+ *
+ * Input lines are either waypoints "x y z [a]" (commas also separate) or
+ * a G-code subset: G0/G1 with X Y Z A words, G90 and G91. Comments start
+ * with ';' or '('. Coordinates are motor pulses, or millimeters with -d
+ * (MTO_FPD delta kinematics, matching "mov" on a delta machine).
+ */
+typedef class StrokeCompiler {
+public:
+    CompileOptions opts;
+private:
+    DeltaCalculator delta;
+    int lineNum;
+
+private:
+    void compileError(const char *msg, const std::string &line);
+    bool motorPosition(PH5TYPE coord[QUAD_ELEMENTS], Quad<StepCoord> &pos);
+    int parseLine(std::string line, PH5TYPE coord[QUAD_ELEMENTS]);
+
+public:
+    StrokeCompiler();
+    void setup();
+    Status buildStroke(Stroke &stroke, Quad<StepCoord> dPos);
+    void writeStroke(std::ostream &out, Stroke &stroke);
+    int compile(std::istream &in, std::ostream &out, PH5TYPE start[QUAD_ELEMENTS]);
+} StrokeCompiler;
+
+} // namespace firestep
+
+#endif
@@ -0,0 +1,536 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "FireLog.h"
+#include "version.h"
+#include "Arduino.h"
+
+#include "MachineThread.h"
+#include "Display.h"
+#include "DeltaCalculator.h"
+
+using namespace std;
+using namespace firestep;
+using namespace ArduinoJson;
+
+/**
+ * Microbenchmarks for the motion and protocol hot paths.
+ * Each benchmark performs n operations and is calibrated so that one sample
+ * runs for at least BENCH_SAMPLE_NS. The reported ns/op is the median of
+ * BENCH_SAMPLES samples, which is what the baseline gates. cycles_op
+ * reports the modeled MockDuino I/O cycles (pin writes, pulses, timer
+ * reads and serial output) for information; it does not count compute.
+ */
+#define BENCH_SAMPLES 5
+#define BENCH_SAMPLE_NS 20000000LL // 20ms
+#define BENCH_EPSILON 0.05 // baseline values are printed to 0.1
+#define BENCH_BASELINE_SIZE 8192
+
+typedef void (*BenchFn)(int32_t n);
+
+typedef struct BenchResult {
+    double nsOp;
+    double cyclesOp;
+} BenchResult;
+
+class BenchStepper : public QuadStepper {
+public:
+    Quad<StepCoord> dPos;
+    virtual Status stepDirection(const Quad<StepDV> &pulse) {
+        return STATUS_OK;
+    }
+    virtual Status stepFast(Quad<StepDV> &pulse) {
+        return step(pulse);
+    }
+    virtual Status step(const Quad<StepDV> &pulse) {
+        dPos += pulse;
+        return STATUS_OK;
+    }
+};
+
+Machine *pMachine;
+JsonController *pController;
+DeltaCalculator deltaCalc;
+StrokeBuilder strokeBuilder;
+Stroke benchStroke;
+BenchStepper benchStepper;
+JsonCommand benchCmd;
+volatile int32_t benchSink; // keeps results live
+
+int64_t nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void bench_buildLine(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        strokeBuilder.buildLine(benchStroke, Quad<StepCoord>(6400, 3200, 1600, 0));
+    }
+    benchSink = benchStroke.length;
+}
+
+/**
+ * Interpolate at the start of each segment but the last in turn, which
+ * makes the segment work per operation independent of the stroke duration.
+ * Stroke time starts at 0 after buildLine().
+ */
+void bench_goalPos(int32_t n) {
+    Ticks dt = benchStroke.get_dtTotal();
+    SegIndex segs = benchStroke.length;
+    int32_t sum = 0;
+    for (int32_t i = 0; i < n; i++) {
+        SegIndex s = 1 + (i % (segs - 1));
+        sum += benchStroke.goalPos((s * dt) / segs).value[0];
+    }
+    benchSink = sum;
+}
+
+void bench_traverse(int32_t n) {
+    Ticks dt = benchStroke.get_dtTotal();
+    for (int32_t i = 0; i < n; i++) {
+        Ticks t = i % (dt + 1);
+        if (t == 0) {
+            benchStroke.start(1);
+            benchStepper.dPos.clear();
+        }
+        benchStroke.traverse(1 + t, benchStepper);
+    }
+    benchSink = benchStepper.dPos.value[0];
+}
+
+void bench_stepFast(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        Quad<StepDV> burst(4, 4, 4, 0);
+        pMachine->stepFast(burst);
+    }
+}
+
+void bench_calcPulses(int32_t n) {
+    int32_t sum = 0;
+    for (int32_t i = 0; i < n; i++) {
+        PH5TYPE v = (i % 64) - 32;
+        Step3D pulses = deltaCalc.calcPulses(XYZ3D(v, -v, v - 20));
+        sum += pulses.p1;
+    }
+    benchSink = sum;
+}
+
+void bench_calcXYZ(int32_t n) {
+    Step3D homePulses = deltaCalc.getHomePulses();
+    int32_t sum = 0;
+    for (int32_t i = 0; i < n; i++) {
+        StepCoord v = (i % 64) * 16;
+        XYZ3D xyz = deltaCalc.calcXYZ(Step3D(homePulses.p1 + v,
+                                             homePulses.p2 + v / 2, homePulses.p3 + 100));
+        sum += (int32_t) xyz.z;
+    }
+    benchSink = sum;
+}
+
+const char *parseCmds[] = {
+    "{\"sys\":\"\"}",
+    "{\"mov\":{\"x\":10,\"y\":20,\"z\":-5}}",
+    "{\"dpyds\":12,\"x\":\"\",\"y\":\"\",\"z\":\"\"}",
+    "[{\"mpo\":\"\"},{\"xen\":true,\"yen\":true},{\"sys\":\"\"}]",
+};
+#define PARSE_CMDS ((int32_t)(sizeof(parseCmds)/sizeof(parseCmds[0])))
+
+void bench_parse(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        benchCmd.clear();
+        benchSink = benchCmd.parse(parseCmds[i % PARSE_CMDS], STATUS_WAIT_IDLE);
+    }
+    Serial.clear();
+}
+
+/**
+ * Build the parse commands from Serial a byte at a time, as MachineThread
+ * receives them
+ */
+void bench_parseSerial(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        benchCmd.clear();
+        Serial.push(parseCmds[i % PARSE_CMDS]);
+        Serial.push("\n");
+        benchSink = benchCmd.parse(NULL, STATUS_WAIT_IDLE);
+    }
+    Serial.clear();
+}
+
+/**
+ * Fixed per-command overhead: clear() and reading the shortest request
+ * line from Serial, as MachineThread does for every command.
+ */
+void bench_command(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        benchCmd.clear();
+        Serial.push("{\"a\":1}\n");
+        benchSink = benchCmd.parse(NULL, STATUS_WAIT_IDLE);
+    }
+    Serial.clear();
+}
+
+/**
+ * Parse and process one query command; parse cost is reported separately
+ * by bench_parse.
+ */
+void benchProcess(const char *json, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        benchCmd.clear();
+        benchCmd.parse(json, STATUS_WAIT_IDLE);
+        benchSink = pController->process(benchCmd);
+        Serial.clear();
+    }
+}
+
+void bench_process_sys(int32_t n) {
+    benchProcess("{\"sys\":\"\"}", n);
+}
+
+void bench_process_mpo(int32_t n) {
+    benchProcess("{\"mpo\":\"\"}", n);
+}
+
+void bench_process_x(int32_t n) {
+    benchProcess("{\"x\":\"\"}", n);
+}
+
+void bench_traverseMachine(int32_t n) {
+    Ticks dt = benchStroke.get_dtTotal();
+    for (int32_t i = 0; i < n; i++) {
+        Ticks t = i % (dt + 1);
+        if (t == 0) {
+            benchStroke.start(1);
+            pMachine->setMotorPosition(Quad<StepCoord>());
+        }
+        benchStroke.traverse(1 + t, *pMachine);
+    }
+}
+
+BenchResult benchRun(BenchFn fn) {
+    fn(1); // warm up
+    int32_t n = 1;
+    while (true) {
+        int64_t t = nanos();
+        fn(n);
+        if (nanos() - t >= BENCH_SAMPLE_NS || n >= (1L << 30)) {
+            break;
+        }
+        n *= 2;
+    }
+    double samples[BENCH_SAMPLES];
+    uint64_t cycles = 0;
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t c = arduino.get_cycles();
+        int64_t t = nanos();
+        fn(n);
+        samples[i] = (double)(nanos() - t) / n;
+        cycles = arduino.get_cycles() - c;
+    }
+    std::sort(samples, samples + BENCH_SAMPLES);
+    BenchResult result;
+    result.nsOp = samples[BENCH_SAMPLES / 2];
+    result.cyclesOp = (double) cycles / n;
+    return result;
+}
+
+typedef struct Bench {
+    const char *name;
+    BenchFn fn;
+} Bench;
+
+Bench benches[] = {
+    { "buildLine", bench_buildLine },
+    { "goalPos", bench_goalPos },
+    { "traverse", bench_traverse },
+    { "traverseMachine", bench_traverseMachine },
+    { "stepFast", bench_stepFast },
+    { "calcPulses", bench_calcPulses },
+    { "calcXYZ", bench_calcXYZ },
+    { "command", bench_command },
+    { "parse", bench_parse },
+    { "parseSerial", bench_parseSerial },
+    { "process_sys", bench_process_sys },
+    { "process_mpo", bench_process_mpo },
+    { "process_x", bench_process_x },
+};
+#define BENCHES ((int)(sizeof(benches)/sizeof(benches[0])))
+
+BenchResult results[BENCHES];
+bool benchRan[BENCHES];
+
+void benchSetup() {
+    arduino.clear();
+    arduino.setPin(PC2_X_MIN_PIN, false);
+    arduino.setPin(PC2_Y_MIN_PIN, false);
+    arduino.setPin(PC2_Z_MIN_PIN, false);
+    threadRunner.clear();
+    threadRunner.setup();
+    pMachine = new Machine();
+    pMachine->setup(PC2_RAMPS_1_4);
+    pMachine->pDisplay->setStatus(DISPLAY_WAIT_IDLE);
+    pController = new JsonController(*pMachine);
+    deltaCalc.setup();
+    strokeBuilder.buildLine(benchStroke, Quad<StepCoord>(6400, 3200, 1600, 0));
+    Serial.clear();
+}
+
+/**
+ * Discards the TESTCOUT diagnostics that firmware code writes to cout,
+ * which would otherwise be timed and mixed into the JSON output.
+ */
+class NullBuf : public streambuf {
+protected:
+    virtual int overflow(int c) {
+        return c;
+    }
+};
+
+/**
+ * Regression tolerance for metric is the fractional increase allowed over
+ * the baseline value. A "tolerance" object in the benchmark entry overrides
+ * the top-level "tolerance" object. The default is 0.
+ */
+double baselineTolerance(JsonObject &jroot, JsonObject &jbench, const char *metric) {
+    if (jbench.at("tolerance").is<JsonObject&>()) {
+        JsonObject &jtol = jbench["tolerance"];
+        if (jtol.at(metric).success()) {
+            double tolerance = jtol[metric];
+            return tolerance;
+        }
+    }
+    if (jroot.at("tolerance").is<JsonObject&>()) {
+        JsonObject &jtol = jroot["tolerance"];
+        if (jtol.at(metric).success()) {
+            double tolerance = jtol[metric];
+            return tolerance;
+        }
+    }
+    return 0;
+}
+
+int baselineMissing; // metrics measured but not in baseline
+
+/**
+ * Compare one measured metric with its baseline. Returns 1 for a regression.
+ */
+int baselineCompare(JsonObject &jroot, JsonObject &jbench,
+                    const char *name, const char *metric, double value) {
+    if (!jbench.at(metric).success()) {
+        char buf[200];
+        snprintf(buf, sizeof(buf), "BENCH\t: %-16s %-9s %12.1f baseline:     MISSING",
+                 name, metric, value);
+        cerr << buf << endl;
+        baselineMissing++;
+        return 0;
+    }
+    double base = jbench[metric];
+    double tolerance = baselineTolerance(jroot, jbench, metric);
+    double limit = base * (1 + tolerance);
+    const char *verdict = "ok";
+    int regressions = 0;
+    if (value > limit + BENCH_EPSILON) {
+        verdict = "REGRESSION";
+        regressions = 1;
+    } else if (value < base * (1 - tolerance) - BENCH_EPSILON) {
+        verdict = "improved";
+    }
+    char buf[200];
+    snprintf(buf, sizeof(buf), "BENCH\t: %-16s %-9s %12.1f baseline:%12.1f tolerance:%3.0f%% %s",
+             name, metric, value, base, tolerance * 100, verdict);
+    cerr << buf << endl;
+    return regressions;
+}
+
+int baselineCheck(JsonObject &jroot) {
+    if (!jroot.at("bench").is<JsonObject&>()) {
+        cerr << "ERROR\t: baseline has no \"bench\" object" << endl;
+        return -1;
+    }
+    JsonObject &jbenches = jroot["bench"];
+    int regressions = 0;
+    for (int i = 0; i < BENCHES; i++) {
+        if (!benchRan[i]) {
+            continue;
+        }
+        if (!jbenches.at(benches[i].name).is<JsonObject&>()) {
+            cerr << "BENCH\t: " << benches[i].name << " not in baseline" << endl;
+            baselineMissing++;
+            continue;
+        }
+        JsonObject &jbench = jbenches[benches[i].name];
+        regressions += baselineCompare(jroot, jbench, benches[i].name,
+                                       "ns_op", results[i].nsOp);
+    }
+    return regressions;
+}
+
+void writeTolerance(ostream &os, JsonObject &jobj) {
+    if (!jobj.at("tolerance").is<JsonObject&>()) {
+        return;
+    }
+    JsonObject &jtol = jobj["tolerance"];
+    os << "\"tolerance\":{";
+    const char *sep = "";
+    for (JsonObject::iterator it = jtol.begin(); it != jtol.end(); ++it) {
+        double tolerance = it->value;
+        char buf[100];
+        snprintf(buf, sizeof(buf), "%s\"%s\":%g", sep, it->key, tolerance);
+        os << buf;
+        sep = ",";
+    }
+    os << "}";
+}
+
+/**
+ * Write baseline with the measured ns_op values, keeping all tolerances
+ * and the entries of benchmarks that did not run
+ */
+void baselineWrite(ostream &os, JsonObject &jroot) {
+    os << "{";
+    if (jroot.at("tolerance").is<JsonObject&>()) {
+        writeTolerance(os, jroot);
+        os << ",";
+    }
+    os << "\n\"bench\":{";
+    JsonObject *pjbenches = jroot.at("bench").is<JsonObject&>() ?
+                            &(JsonObject&) jroot["bench"] : NULL;
+    const char *sep = "";
+    for (int i = 0; i < BENCHES; i++) {
+        JsonObject *pjbench = NULL;
+        if (pjbenches && pjbenches->at(benches[i].name).is<JsonObject&>()) {
+            pjbench = &(JsonObject&) (*pjbenches)[benches[i].name];
+        }
+        if (!benchRan[i] && !pjbench) {
+            continue;
+        }
+        os << sep << "\n\"" << benches[i].name << "\":{";
+        const char *fieldSep = "";
+        double value = 0;
+        bool known = true;
+        if (benchRan[i]) {
+            value = results[i].nsOp;
+        } else if (pjbench->at("ns_op").success()) {
+            value = (*pjbench)["ns_op"];
+        } else {
+            known = false;
+        }
+        if (known) {
+            char buf[100];
+            snprintf(buf, sizeof(buf), "\"ns_op\":%.1f", value);
+            os << buf;
+            fieldSep = ",";
+        }
+        if (pjbench && pjbench->at("tolerance").is<JsonObject&>()) {
+            os << fieldSep;
+            writeTolerance(os, *pjbench);
+        }
+        os << "}";
+        sep = ",";
+    }
+    os << "\n}}" << endl;
+}
+
+char baselineJson[BENCH_BASELINE_SIZE];
+
+/**
+ * Usage: bench [-b baseline.json [-u]] [name...]
+ * Prints {"bench":{"<name>":{"ns_op":...,"ops_s":...,"cycles_op":...},...}}
+ * for all benchmarks or just the named ones.
+ *   -b  compare ns_op with baseline and exit 1 on any regression, or 3 if
+ *       a benchmark that ran has no baseline value
+ *   -u  rewrite the baseline ns_op values with the measured values
+ */
+int main(int argc, char *argv[]) {
+    firelog_level(FIRELOG_WARN);
+    bool update = false;
+    const char *baselinePath = NULL;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp("-u", argv[argi]) == 0) {
+            update = true;
+        } else if (strcmp("-b", argv[argi]) == 0 && argi + 1 < argc) {
+            baselinePath = argv[++argi];
+        } else {
+            cerr << "Usage: bench [-b baseline.json [-u]] [name...]" << endl;
+            return 2;
+        }
+    }
+
+    if (update && !baselinePath) {
+        cerr << "ERROR\t: -u requires -b baseline.json" << endl;
+        return 2;
+    }
+
+    StaticJsonBuffer<BENCH_BASELINE_SIZE> jbBaseline;
+    JsonObject *pjroot = NULL;
+    if (baselinePath) {
+        ifstream ifs(baselinePath);
+        string text((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+        if (text.size() >= sizeof(baselineJson)) {
+            cerr << "ERROR\t: baseline too large " << baselinePath << endl;
+            return 2;
+        }
+        strcpy(baselineJson, text.c_str());
+        pjroot = &jbBaseline.parseObject(baselineJson);
+        if (!ifs.is_open() && update) {
+            pjroot = &jbBaseline.createObject(); // new baseline
+        } else if (!pjroot->success()) {
+            cerr << "ERROR\t: could not read baseline " << baselinePath << endl;
+            return 2;
+        }
+    }
+
+    NullBuf nullBuf;
+    ostream json(cout.rdbuf());
+    cout.rdbuf(&nullBuf);
+    benchSetup();
+
+    json << "{\"bench\":{";
+    const char *sep = "";
+    for (int i = 0; i < BENCHES; i++) {
+        bool selected = argi >= argc;
+        for (int j = argi; !selected && j < argc; j++) {
+            selected = strcmp(argv[j], benches[i].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        results[i] = benchRun(benches[i].fn);
+        benchRan[i] = true;
+        char buf[200];
+        snprintf(buf, sizeof(buf), "%s\n\"%s\":{\"ns_op\":%.1f,\"ops_s\":%.0f,\"cycles_op\":%.1f}",
+                 sep, benches[i].name, results[i].nsOp, 1e9 / results[i].nsOp, results[i].cyclesOp);
+        json << buf;
+        sep = ",";
+    }
+    json << "\n}}" << endl;
+
+    int regressions = 0;
+    if (pjroot && update) {
+        stringstream ss;
+        baselineWrite(ss, *pjroot);
+        ofstream ofs(baselinePath);
+        ofs << ss.str();
+        cerr << "BENCH\t: updated " << baselinePath << endl;
+    } else if (pjroot) {
+        regressions = baselineCheck(*pjroot);
+        if (regressions < 0) {
+            return 2;
+        }
+        cerr << "BENCH\t: " << regressions << " regression(s)" << endl;
+        if (!regressions && baselineMissing) {
+            cerr << "BENCH\t: " << baselineMissing << " metric(s) missing from baseline" << endl;
+            cout.rdbuf(json.rdbuf());
+            return 3;
+        }
+    }
+    cout.rdbuf(json.rdbuf());
+
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include "FireLog.h"
+#include "version.h"
+#include "Arduino.h"
+
+#include "StrokeCompiler.h"
+
+using namespace std;
+using namespace firestep;
+
+/**
+ * FireStep trajectory compiler command line (see StrokeCompiler)
+ */
+void help() {
+    cerr << "Usage: firestepc [options] [input]" << endl;
+    cerr << "  -v pulses   maximum velocity in pulses/s (default 12800)" << endl;
+    cerr << "  -t seconds  time to reach maximum velocity (default 0.7)" << endl;
+    cerr << "  -d          delta (MTO_FPD) coordinates in millimeters" << endl;
+    cerr << "  -s x,y,z,a  start position (default 0,0,0,0)" << endl;
+    cerr << "  -m min,max  motor travel limits in pulses (default -32000,32000)" << endl;
+    cerr << "  -o file     output file (default stdout)" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    firelog_level(FIRELOG_WARN);
+    StrokeCompiler compiler;
+    CompileOptions &opts = compiler.opts;
+    PH5TYPE start[QUAD_ELEMENTS] = {0, 0, 0, 0};
+    const char *outPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "v:t:ds:m:o:h")) != -1) {
+        switch (opt) {
+        case 'v':
+            opts.vMax = atol(optarg);
+            break;
+        case 't':
+            opts.tvMax = atof(optarg);
+            break;
+        case 'd':
+            opts.delta = true;
+            break;
+        case 's': {
+            float x = 0, y = 0, z = 0, a = 0;
+            if (sscanf(optarg, "%f,%f,%f,%f", &x, &y, &z, &a) < 3) {
+                help();
+                return 2;
+            }
+            start[0] = x;
+            start[1] = y;
+            start[2] = z;
+            start[3] = a;
+            break;
+        }
+        case 'm': {
+            int travelMin, travelMax;
+            if (sscanf(optarg, "%d,%d", &travelMin, &travelMax) != 2) {
+                help();
+                return 2;
+            }
+            opts.travelMin = travelMin;
+            opts.travelMax = travelMax;
+            break;
+        }
+        case 'o':
+            outPath = optarg;
+            break;
+        default:
+            help();
+            return 2;
+        }
+    }
+    compiler.setup();
+
+    ofstream ofs;
+    if (outPath) {
+        ofs.open(outPath);
+        if (!ofs.is_open()) {
+            cerr << "ERROR\t: could not open " << outPath << endl;
+            return 2;
+        }
+    }
+    ostream out(outPath ? ofs.rdbuf() : cout.rdbuf());
+    cout.rdbuf(NULL); // discard firmware TESTCOUT diagnostics
+
+    if (optind < argc) {
+        ifstream ifs(argv[optind]);
+        if (!ifs.is_open()) {
+            cerr << "ERROR\t: could not open " << argv[optind] << endl;
+            return 2;
+        }
+        return compiler.compile(ifs, out, start);
+    }
+    return compiler.compile(cin, out, start);
+}
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "FireLog.h"
+#include "version.h"
+#include "Arduino.h"
+
+#include "MachineThread.h"
+
+using namespace std;
+using namespace firestep;
+
+/**
+ * FireStep daemon: simulated FireStep controllers served on pseudo-terminals.
+ * Each controller runs the firmware against its own MockDuino on its own
+ * host thread. The MockDuino cycle clock is paced to wall-clock time, so
+ * moves take as long as they would on the device.
+ */
+#define DAEMON_IDLE_MS 1 // poll timeout while waiting for input
+#define DAEMON_READ_BYTES 64 // serial bytes read per loop
+#define DAEMON_CATCHUP_US 100000 // longest virtual clock jump
+
+volatile sig_atomic_t daemonStop;
+
+typedef struct VirtualController {
+    int id;
+    int fdMaster;
+    int fdSlave;
+    PinConfig pinConfig;
+    string link;
+} VirtualController;
+
+int64_t wallMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Open a raw pseudo-terminal pair. The slave end stays open here so that
+ * clients can connect and disconnect without hanging up the master.
+ */
+int openPty(VirtualController &vc) {
+    vc.fdMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if (vc.fdMaster < 0 || grantpt(vc.fdMaster) || unlockpt(vc.fdMaster)) {
+        return -1;
+    }
+    const char *slaveName = ptsname(vc.fdMaster);
+    vc.fdSlave = slaveName ? open(slaveName, O_RDWR | O_NOCTTY) : -1;
+    if (vc.fdSlave < 0) {
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(vc.fdSlave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(vc.fdSlave, TCSANOW, &tio);
+    fcntl(vc.fdMaster, F_SETFL, fcntl(vc.fdMaster, F_GETFL) | O_NONBLOCK);
+    if (!vc.link.empty()) {
+        unlink(vc.link.c_str());
+        if (symlink(slaveName, vc.link.c_str())) {
+            return -1;
+        }
+    }
+    cerr << "STATUS\t: controller " << vc.id << " on " << slaveName;
+    if (!vc.link.empty()) {
+        cerr << " (" << vc.link << ")";
+    }
+    cerr << endl;
+    return 0;
+}
+
+void writeAll(int fd, const string &s) {
+    for (size_t done = 0; done < s.size(); ) {
+        ssize_t n = write(fd, s.data() + done, s.size() - done);
+        if (n > 0) {
+            done += n;
+        } else {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            poll(&pfd, 1, DAEMON_IDLE_MS);
+        }
+    }
+}
+
+/**
+ * Run one controller until the daemon stops. Modeled cycles are the virtual
+ * clock. When the firmware gets ahead of wall-clock time the loop sleeps;
+ * when it falls behind, the clock catches up as if the MCU had been busy.
+ */
+void serveController(VirtualController *pvc) {
+    VirtualController &vc(*pvc);
+    arduino.clear();
+    threadRunner.clear();
+    MachineThread mt;
+    mt.setup(vc.pinConfig);
+    for (int i = 0; i < 3; i++) {
+        if (mt.machine.axis[i].pinMin != NOPIN) {
+            arduino.setPin(mt.machine.axis[i].pinMin, 0); // limit switches open
+        }
+    }
+    threadRunner.setup();
+    arduino.useCycleClock();
+
+    int64_t usStart = wallMicros();
+    uint64_t cycleStart = arduino.get_cycles();
+    while (!daemonStop) {
+        uint8_t buf[DAEMON_READ_BYTES];
+        ssize_t n = read(vc.fdMaster, buf, sizeof(buf));
+        for (ssize_t i = 0; i < n; i++) {
+            Serial.push(buf[i]);
+        }
+
+        threadRunner.outerLoop();
+
+        string out = Serial.output();
+        if (!out.empty()) {
+            writeAll(vc.fdMaster, out);
+        }
+
+        int64_t usVirtual = (int64_t)(arduino.get_cycles() - cycleStart) / CYCLES_PER_US;
+        int64_t usWall = wallMicros() - usStart;
+        if (usVirtual > usWall) {
+            usleep(usVirtual - usWall);
+        } else {
+            int64_t usLag = min(usWall - usVirtual, (int64_t) DAEMON_CATCHUP_US);
+            arduino.cycles((int32_t) usLag * CYCLES_PER_US);
+            if (n <= 0 && out.empty() && mt.status == STATUS_WAIT_IDLE && !Serial.available()) {
+                struct pollfd pfd = { vc.fdMaster, POLLIN, 0 };
+                poll(&pfd, 1, DAEMON_IDLE_MS);
+            }
+        }
+    }
+    threadRunner.clear();
+}
+
+void onSignal(int sig) {
+    daemonStop = 1;
+}
+
+void help() {
+    cerr << "Usage: firestepd [-n count] [-p pinConfig] [-l link]" << endl;
+    cerr << "  -n  number of simulated controllers (default 1)" << endl;
+    cerr << "  -p  pin configuration (default " << PC2_RAMPS_1_4 << ")" << endl;
+    cerr << "  -l  symlink to the pty, numbered when count > 1" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    firelog_level(FIRELOG_WARN);
+    cout.setstate(ios::failbit); // discard firmware TESTCOUT diagnostics
+    int count = 1;
+    PinConfig pinConfig = PC2_RAMPS_1_4;
+    const char *link = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:l:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'p':
+            pinConfig = (PinConfig) atoi(optarg);
+            break;
+        case 'l':
+            link = optarg;
+            break;
+        default:
+            help();
+            return 2;
+        }
+    }
+    if (count < 1) {
+        help();
+        return 2;
+    }
+    cerr << "INFO\t: FireStep daemon v" << VERSION_MAJOR << "." << VERSION_MINOR
+         << "." << VERSION_PATCH << endl;
+
+    vector<VirtualController> controllers(count);
+    for (int i = 0; i < count; i++) {
+        VirtualController &vc(controllers[i]);
+        vc.id = i;
+        vc.pinConfig = pinConfig;
+        if (link) {
+            vc.link = link;
+            if (count > 1) {
+                vc.link += to_string(i);
+            }
+        }
+        if (openPty(vc)) {
+            cerr << "ERROR\t: could not open pty for controller " << i
+                 << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    vector<thread> threads;
+    for (int i = 0; i < count; i++) {
+        threads.push_back(thread(serveController, &controllers[i]));
+    }
+    for (int i = 0; i < count; i++) {
+        threads[i].join();
+    }
+    for (int i = 0; i < count; i++) {
+        if (!controllers[i].link.empty()) {
+            unlink(controllers[i].link.c_str());
+        }
+        close(controllers[i].fdSlave);
+        close(controllers[i].fdMaster);
+    }
+    cerr << "STATUS\t: FireStep daemon stopped" << endl;
+
+    return 0;
+}
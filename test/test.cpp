@@ -2,6 +2,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
 #include "FireLog.h"
 #include "FireUtils.h"
 #include "version.h"
@@ -10,6 +11,7 @@
 #include "MachineThread.h"
 #include "Display.h"
 #include "DeltaCalculator.h"
+#include "StrokeCompiler.h"
 
 byte lastByte;
 
@@ -123,6 +125,251 @@ void test_Thread() {
     cout << "TEST	: test_Thread() OK " << endl;
 }
 
+string threadRuns;
+
+typedef struct TestThread : Thread {
+    Ticks period; // 0 for ASAP
+    int cost; // timer ticks used by loop()
+    TestThread(char id, Ticks period, byte priority) : period(period), cost(0) {
+        this->id = id;
+        this->priority = priority;
+    }
+    void loop() {
+        threadRuns += id;
+        arduino.timer1(cost);
+        nextLoop.ticks = period ? threadClock.ticks + period : 0;
+    }
+} TestThread;
+
+void test_ThreadRunner() {
+    cout << "TEST	: test_ThreadRunner() =====" << endl;
+
+    arduino.clear();
+    threadRunner.clear();
+    threadRunner.setup();
+    monitor.verbose = false;
+    TestThread a('a', 0, 0);
+    TestThread b('b', 100, 0);
+    TestThread c('c', 100, 5);
+    a.setup();
+    b.setup();
+    c.setup();
+    a.setup(); // already active
+    ASSERTEQUAL(4, nThreads);
+    ASSERTEQUAL(4, threadRunner.get_scheduled());
+
+    // new threads are ASAP, highest priority first
+    threadRuns = "";
+    test_ticks(1);
+    ASSERTEQUALS("cab", threadRuns.c_str());
+
+    // only ASAP threads run until timed threads are due
+    threadRuns = "";
+    test_ticks(1);
+    test_ticks(98);
+    ASSERTEQUALS("aa", threadRuns.c_str());
+    threadRuns = "";
+    test_ticks(1);
+    ASSERTEQUALS("acb", threadRuns.c_str());
+
+    // a thread leaving ASAP joins the timed threads
+    a.period = 50;
+    threadRuns = "";
+    test_ticks(1);
+    test_ticks(49);
+    ASSERTEQUALS("a", threadRuns.c_str());
+    threadRuns = "";
+    test_ticks(1);
+    test_ticks(49);
+    ASSERTEQUALS("acb", threadRuns.c_str());
+    ASSERTEQUAL(4, threadRunner.get_scheduled());
+    ASSERTEQUAL(0, nTardies);
+
+    // loop() profile
+    ASSERTEQUAL(6, a.runCount);
+    ASSERTEQUAL(3, b.runCount);
+    ASSERTEQUAL(3, c.runCount);
+    ASSERTEQUAL(0, a.runTicks);
+    threadRunner.clearProfile();
+    ASSERTEQUAL(0, a.runCount);
+    a.cost = 3;
+    test_ticks(1);
+    a.cost = 1;
+    test_ticks(50);
+    ASSERTEQUAL(2, a.runCount);
+    ASSERTEQUAL(4, a.runTicks);
+    ASSERTEQUAL(3, a.runMax);
+    ASSERTEQUAL(0, b.runCount);
+
+    threadRunner.clear();
+
+    cout << "TEST	: test_ThreadRunner() OK " << endl;
+}
+
+void test_ticksWrap() {
+    cout << "TEST	: test_ticksWrap() =====" << endl;
+
+    arduino.clear();
+    threadRunner.clear();
+    threadRunner.setup();
+    monitor.verbose = false;
+    TestThread a('a', 30000, 0);
+    a.setup();
+
+    // run past the 32-bit wrap (~76 hours) in steps under a generation
+    Ticks tStart = ticks();
+    Ticks tLast = tStart;
+    bool negative = false;
+    for (int32_t i = 0; i < 140000; i++) {
+        test_ticks(32000);
+        Ticks t = ticks();
+        if (ticksElapsed(t, tLast) != 32001) {
+            ASSERTEQUAL(32001, ticksElapsed(t, tLast));
+        }
+        tLast = t;
+        negative = negative || t < 0;
+    }
+    ASSERT(negative);
+    ASSERTEQUAL(140000*32001.0 - 4294967296.0, tLast - tStart); // wrapped
+    ASSERTEQUAL(140000 - 140000/256, a.runCount); // outerLoop() skips every 256th pass
+    ASSERTEQUAL(0, a.tardies);
+
+    threadRunner.clear();
+
+    cout << "TEST	: test_ticksWrap() OK " << endl;
+}
+
+void test_cycleClock() {
+    cout << "TEST	: test_cycleClock() =====" << endl;
+
+    arduino.clear();
+    arduino.setPin(PC2_X_MIN_PIN, 0);
+    arduino.setPin(PC2_Y_MIN_PIN, 0);
+    arduino.setPin(PC2_Z_MIN_PIN, 0);
+    threadRunner.clear();
+    threadRunner.setup();
+    Machine machine;
+    machine.setup(PC2_RAMPS_1_4);
+    ASSERTEQUAL(STATUS_OK, machine.step(Quad<StepDV>(1, 1, 1, 0))); // set direction
+    arduino.useCycleClock();
+
+    // TCNT1 counts modeled cycles with TIMER_PRESCALE
+    int16_t tcnt1 = TCNT1;
+    uint64_t cycles = arduino.get_cycles();
+    for (int i = 0; i < 1024; i++) {
+        pulseFast(PC2_X_STEP_PIN);
+    }
+    int32_t pulseCycles = CYCLES_PULSEFAST + 4 * CYCLES_DELAY500NS;
+    ASSERTEQUAL(1024 * pulseCycles, arduino.get_cycles() - cycles);
+    ASSERTEQUAL(pulseCycles, (uint16_t)(TCNT1 - tcnt1));
+    tcnt1 = TCNT1;
+    for (int i = 0; i < 16; i++) {
+        digitalWrite(PC2_X_DIR_PIN, i & 1);
+    }
+    ASSERTEQUAL(0, (uint16_t)(TCNT1 - tcnt1));
+    delayMicroseconds(8);
+    ASSERTEQUAL(1, (uint16_t)(TCNT1 - tcnt1)); // 16*56 + 8*16 = 1024 cycles
+    delayMics(64);
+    ASSERTEQUAL(2, (uint16_t)(TCNT1 - tcnt1));
+    cycles = arduino.get_cycles();
+    ticks();
+    ASSERTEQUAL(CYCLES_TIMERREAD, arduino.get_cycles() - cycles);
+
+    // predicted step rates
+    cycles = arduino.get_cycles();
+    ASSERTEQUAL(STATUS_OK, machine.step(Quad<StepDV>(1, 1, 1, 0)));
+    int32_t stepCycles = arduino.get_cycles() - cycles;
+    ASSERTEQUAL(6 * CYCLES_DIGITALWRITE, stepCycles);
+    cout << "cycleClock	: step(1,1,1,0) " << stepCycles << " cycles "
+         << CLOCK_HZ / stepCycles << " steps/s" << endl;
+    machine.axis[0].usDelay = 80;
+    cycles = arduino.get_cycles();
+    ASSERTEQUAL(STATUS_OK, machine.step(Quad<StepDV>(1, 1, 1, 0)));
+    stepCycles = arduino.get_cycles() - cycles;
+    ASSERTEQUAL(6 * CYCLES_DIGITALWRITE + 80 * 2 * CYCLES_DELAY500NS, stepCycles);
+    cout << "cycleClock	: step(1,1,1,0) usDelay:80 " << stepCycles << " cycles "
+         << CLOCK_HZ / stepCycles << " steps/s" << endl;
+    Quad<StepDV> burst(4, 4, 4, 0);
+    cycles = arduino.get_cycles();
+    ASSERTEQUAL(STATUS_OK, machine.stepFast(burst));
+    stepCycles = arduino.get_cycles() - cycles;
+    ASSERTEQUAL(12 * pulseCycles, stepCycles);
+    cout << "cycleClock	: stepFast(4,4,4,0) " << stepCycles << " cycles "
+         << 4 * CLOCK_HZ / stepCycles << " steps/s" << endl;
+
+    arduino.useCycleClock(false);
+    threadRunner.clear();
+
+    cout << "TEST	: test_cycleClock() OK " << endl;
+}
+
+void test_trace() {
+    cout << "TEST	: test_trace() =====" << endl;
+
+    arduino.clear();
+    arduino.setPin(PC2_X_MIN_PIN, 0);
+    arduino.setPin(PC2_Y_MIN_PIN, 0);
+    arduino.setPin(PC2_Z_MIN_PIN, 0);
+    threadRunner.clear();
+    threadRunner.setup();
+    Machine machine;
+    machine.setup(PC2_RAMPS_1_4);
+    arduino.tracePin(PC2_X_STEP_PIN);
+    arduino.tracePin(PC2_X_DIR_PIN);
+    arduino.traceStart(100);
+    ASSERTEQUAL(2, arduino.traceSize()); // initial levels
+    digitalWrite(PC2_X_DIR_PIN, LOW);
+    pulseFast(PC2_Y_STEP_PIN); // not traced
+    pulseFast(PC2_X_STEP_PIN);
+    pulseFast(PC2_X_STEP_PIN);
+    ASSERTEQUAL(7, arduino.traceSize());
+    PinEvent dir = arduino.traceEvent(2);
+    PinEvent step = arduino.traceEvent(3);
+    ASSERTEQUAL(PC2_X_DIR_PIN, dir.pin);
+    ASSERTEQUAL(LOW, dir.level);
+    ASSERTEQUAL(PC2_X_STEP_PIN, step.pin);
+    ASSERTEQUAL(HIGH, step.level);
+    ASSERTEQUAL(2 * CYCLES_PULSEFAST + 4 * CYCLES_DELAY500NS, step.cycles - dir.cycles);
+
+    stringstream vcd;
+    arduino.traceVCD(vcd);
+    ASSERTEQUALS(
+        "$timescale 100ps $end\n"
+        "$scope module mockduino $end\n"
+        "$var wire 1 W pin54 $end\n"
+        "$var wire 1 X pin55 $end\n"
+        "$upscope $end\n"
+        "$enddefinitions $end\n"
+        "#0\n0W\n1X\n"
+        "#35000\n0X\n"
+        "#85000\n1W\n"
+        "#105000\n0W\n"
+        "#120000\n1W\n"
+        "#140000\n0W\n",
+        vcd.str().c_str());
+
+    // ring buffer keeps the newest events
+    arduino.traceStart(3);
+    pulseFast(PC2_X_STEP_PIN);
+    pulseFast(PC2_X_STEP_PIN);
+    arduino.traceStop();
+    pulseFast(PC2_X_STEP_PIN);
+    ASSERTEQUAL(3, arduino.traceSize());
+    ASSERTEQUAL(LOW, arduino.traceEvent(0).level);
+    ASSERTEQUAL(HIGH, arduino.traceEvent(1).level);
+    ASSERTEQUAL(LOW, arduino.traceEvent(2).level);
+    stringstream bin;
+    arduino.traceWrite(bin);
+    string bytes = bin.str();
+    ASSERTEQUAL(18, bytes.size());
+    ASSERTEQUAL(PC2_X_STEP_PIN, bytes[4]);
+    ASSERTEQUAL(LOW, bytes[5]);
+
+    threadRunner.clear();
+
+    cout << "TEST	: test_trace() OK " << endl;
+}
+
 void test_command(const char *cmd, const char* expected) {
     Serial.clear();
     Serial.push(cmd);
@@ -222,6 +469,19 @@ void test_Machine() {
 	machine.axis[5].pinStep = 3;
 	ASSERTEQUAL(hash2, machine.hash());
 
+	// configuration hash is cached until invalidated
+	machine.axis[0].travelMax = 1234;
+	ASSERTEQUAL(hash2, machine.hash());
+	machine.invalidateHash();
+	ASSERT(hash2 != machine.hash());
+	machine.axis[0].travelMax = 32000;
+	machine.invalidateHash();
+	ASSERTEQUAL(hash2, machine.hash());
+	machine.axis[4].enable(false);
+	ASSERT(hash2 != machine.hash());
+	machine.axis[4].enable(true);
+	ASSERTEQUAL(hash2, machine.hash());
+
 	// Configuration save
 	char buf[255];
 	char *out = machine.axis[0].saveConfig(buf, sizeof(buf));
@@ -423,13 +683,20 @@ void test_JsonCommand() {
     ASSERT(cmd3.requestRoot().success());
     x = cmd3.requestRoot()["x"];
     ASSERTEQUAL(-0.123, x);
+    ASSERTEQUAL(MAX_JSON - strlen("x") - strlen("-0.123") - 2, cmd3.jsonAvailable());
+    ASSERTEQUAL(MAX_JSON - strlen("{\"x\":123,\"y\":2.3}") - 1, cmd2.jsonAvailable());
+    char *jsonFree = cmd2.allocate(10);
+    ASSERT(jsonFree);
+    ASSERTEQUAL(MAX_JSON - strlen("{\"x\":123,\"y\":2.3}") - 11, cmd2.jsonAvailable());
+    ASSERT(!cmd2.allocate(MAX_JSON));
+    ASSERTEQUALT(2.3, cmd2.requestRoot()["y"], 0.001);
 
     Serial.clear();
     cmd3.requestRoot().printTo(Serial);
     ASSERTEQUALS("{\"x\":-0.123}", Serial.output().c_str());
 
     Serial.clear();
-    cmd3.response().printTo(Serial);
+    cmd3.printResponse(Serial);
     ASSERTEQUALS("{\"s\":10,\"r\":{\"x\":-0.123}}", Serial.output().c_str());
 
     Serial.clear();
@@ -442,6 +709,78 @@ void test_JsonCommand() {
     ASSERT(!cmd4.requestRoot().is<JsonObject&>());
     ASSERTEQUAL(2, cmd4.requestRoot().size());
 
+    // malformed input is rejected before EOL and the rest of the line is discarded
+    Serial.clear();
+    JsonCommand cmd5;
+    Serial.push(JT("{'x':1}}{'y':2}\n{'z':3}\n"));
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUALS("{\"s\":-403}\n", Serial.output().c_str());
+    cmd5.clear();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(3, cmd5.requestRoot()["z"]);
+    cmd5.clear();
+    Serial.push(JT("{'x':1}}")); // rest of line arrives after rejection
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUALS("{\"s\":-403}\n", Serial.output().c_str());
+    Serial.push(JT("{'y':2}"));
+    cmd5.clear();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    Serial.push(JT("\n{'z':3}\n"));
+    cmd5.clear();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(3, cmd5.requestRoot()["z"]);
+    cmd5.clear();
+    Serial.push(JT("{'x':1}}")); // EOL of rejected line is lost
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    arduino.timer1(SKIP_LINE_TICKS + 1);
+    cmd5.clear();
+    Serial.push(JT("{'y':2}\n")); // next command after a pause is not discarded
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(2, cmd5.requestRoot()["y"]);
+    Serial.output();
+    cmd5.clear();
+    Serial.push(JT("x{'y':2}\n"));
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    cmd5.clear();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(0, Serial.available());
+    cmd5.clear();
+    Serial.push(JT("{'s':'}{'}\n"));
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUALS("}{", cmd5.requestRoot()["s"]);
+
+    // clear() resets cursors without erasing text left by a longer command
+    cmd5.clear();
+    Serial.push(JT("{'sys':{'ah':'','as':''},'xyz':'abcdefghijklmnop'}\n"));
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(STATUS_OK, cmd5.setError(STATUS_OK, "abcdefg"));
+    cmd5.clear();
+    ASSERTEQUALS("", cmd5.getError());
+    ASSERTEQUAL(MAX_JSON, cmd5.jsonAvailable());
+    ASSERTEQUAL(STATUS_WAIT_IDLE, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    Serial.push(JT("{'z':4}\n"));
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    Serial.clear();
+    cmd5.requestRoot().printTo(Serial);
+    ASSERTEQUALS("{\"z\":4}", Serial.output().c_str());
+    ASSERTEQUAL(MAX_JSON - strlen("z") - strlen("4") - 2, cmd5.jsonAvailable());
+
+    // serial requests are built as they arrive
+    cmd5.clear();
+    Serial.push(JT("{'a':[1,-2.50,true,null],'b':'q\\'\\n'"));
+    ASSERTEQUAL(STATUS_WAIT_EOL, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    ASSERTEQUAL(-2.5, cmd5.requestRoot()["a"][1]);
+    ASSERTEQUALS("q\"\n", cmd5.requestRoot()["b"]);
+    Serial.push(JT(",'c':{}}\n"));
+    ASSERTEQUAL(STATUS_BUSY_PARSED, cmd5.parse(NULL, STATUS_WAIT_EOL));
+    Serial.clear();
+    cmd5.requestRoot().printTo(Serial);
+    ASSERTEQUALS("{\"a\":[1,-2.50,true,null],\"b\":\"q\\\"\\n\",\"c\":{}}", Serial.output().c_str());
+    cmd5.clear();
+    Serial.push(JT("{'a':1,}\n"));
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, cmd5.parse(NULL, STATUS_WAIT_IDLE));
+    Serial.clear();
+
     cout << "TEST	: test_JsonCommand() OK " << endl;
 }
 
@@ -458,7 +797,6 @@ void testJSON_process(Machine& machine, JsonController&jc, JsonCommand &jcmd, st
     Status actualStatus = jc.process(jcmd);
     ASSERTEQUAL(status, actualStatus);
     ASSERT(jcmd.requestAvailable() > sizeof(JsonVariant));
-    ASSERT(jcmd.responseAvailable() > sizeof(JsonVariant));
     ASSERTEQUALS(jo.c_str(), Serial.output().c_str());
 }
 
@@ -739,6 +1077,20 @@ void test_JsonController() {
              STATUS_OK, VERSION_MAJOR * 100 + VERSION_MINOR + VERSION_PATCH / 100.0);
     ASSERTEQUALS(sysbuf, Serial.output().c_str());
 
+    // group queries are streamed without using request buffer space
+    Serial.clear();
+    jcmd.clear();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, jcmd.parse(
+                    JT("{'sys':'','x':'','y':'','z':'','a':'','b':'','c':''}"), STATUS_WAIT_IDLE));
+    size_t available = jcmd.requestAvailable();
+    ASSERTEQUAL(STATUS_OK, jc.process(jcmd));
+    ASSERTEQUAL(available, jcmd.requestAvailable());
+    string groups = Serial.output();
+    ASSERTEQUAL(0, groups.find(JT("{'s':0,'r':{'sys':{'ah':false,")));
+    ASSERT(groups.find(JT("'v':")) < groups.find(JT("},'x':{'dh':")));
+    ASSERT(groups.find(JT("'ud':0},'c':{'dh':")) != string::npos);
+    ASSERT(groups.find(JT("'ud':0}},'t':")) != string::npos);
+
     test_JsonController_axis(machine, jc, 'x');
     test_JsonController_axis(machine, jc, 'y');
     test_JsonController_axis(machine, jc, 'z');
@@ -900,6 +1252,29 @@ void test_Stroke() {
         }
     }
 
+    // Test traverse() across tick wrap-around
+    Ticks tWrap = (Ticks) 0x7ffffff8L;
+    ASSERTEQUAL(STATUS_OK, stroke.start(tWrap));
+    ASSERTEQUAL(0, (long) stroke.goalSegment(tWrap - 1));
+    ASSERTEQUAL(2, (long) stroke.goalSegment((Ticks)((uint32_t) tWrap + 11)));
+    ASSERTQUAD(Quad<StepCoord>(3, 35, -3, -35), stroke.goalPos((Ticks)((uint32_t) tWrap + 14)));
+    for (int32_t dt = 0; dt < 20; dt++) {
+        if (STATUS_OK == stroke.traverse((Ticks)((uint32_t) tWrap + dt), stepper)) {
+            ASSERTEQUAL(17, dt);
+            break;
+        }
+    }
+    ASSERTQUAD(stroke.dEndPos, stroke.position());
+    ASSERTEQUAL(STATUS_OK, stroke.start(0)); // wrapped ticks can start at 0
+    ASSERTEQUAL(STATUS_BUSY_MOVING, stroke.traverse(0, stepper));
+    stroke.clear();
+    ASSERTEQUAL(STATUS_STROKE_START, stroke.traverse(0, stepper));
+    stroke.append( Quad<StepDV>(1, 10, -1, -10) );
+    stroke.append( Quad<StepDV>(1, 10, -1, -10) );
+    stroke.append( Quad<StepDV>(-1, -10, 1, 10) );
+    stroke.dEndPos = Quad<StepCoord>(4, 40, -4, -40);
+    stroke.setTimePlanned(17/(float) TICKS_PER_SECOND);
+
     // Test scale
     stroke.scale = 30;
     ASSERTEQUAL(STATUS_STROKE_END_ERROR, stroke.start(tStart));
@@ -972,6 +1347,44 @@ void test_Stroke() {
     cout << "TEST	: test_Stroke() OK " << endl;
 }
 
+void test_StrokeBuilder_scale() {
+    cout << "TEST	: test_StrokeBuilder_scale() =====" << endl;
+
+    Stroke stroke;
+    StrokeBuilder sb;
+    ASSERTEQUAL(2, sb.scale);
+    Quad<StepCoord> dPos(200, 101, -51, 0);
+    for (StepCoord scale = 1; scale <= 2; scale++) {
+        sb.scale = scale;
+        ASSERTEQUAL(STATUS_OK, sb.buildLine(stroke, dPos));
+        ASSERTEQUAL(scale, stroke.scale);
+        ASSERTQUAD(dPos, stroke.dEndPos);
+        Quad<StepCoord> v;
+        Quad<StepCoord> pos;
+        for (SegIndex s = 0; s < stroke.length; s++) {
+            for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+                v.value[i] += stroke.seg[s].value[i];
+                pos.value[i] += v.value[i] * scale;
+            }
+        }
+        for (QuadIndex i = 0; i < QUAD_ELEMENTS; i++) {
+            ASSERT(abs(dPos.value[i] - pos.value[i]) < scale); // segment rounding
+        }
+
+        MockStepper stepper;
+        Ticks tStart = 100;
+        ASSERTEQUAL(STATUS_OK, stroke.start(tStart));
+        Status status = STATUS_BUSY_MOVING;
+        for (Ticks t = tStart; status == STATUS_BUSY_MOVING; t++) {
+            status = stroke.traverse(t, stepper);
+        }
+        ASSERTEQUAL(STATUS_OK, status);
+        ASSERTQUAD(dPos, stepper.dPos);
+    }
+
+    cout << "TEST	: test_StrokeBuilder_scale() OK " << endl;
+}
+
 void test_Machine_step() {
     cout << "TEST	: test_Machine_step() =====" << endl;
 
@@ -1219,6 +1632,79 @@ void test_Move() {
     cout << "TEST	: test_Move() OK " << endl;
 }
 
+#define FLEET_SIZE 8
+
+struct FleetMachine {
+    int id;
+    Status status;
+    int32_t zpulses;
+    Quad<StepCoord> position;
+    string output;
+};
+
+/**
+ * Run one simulated machine. Serial, arduino, the thread list and
+ * the other MCU globals are per host thread.
+ */
+void fleetMachine(FleetMachine *pfm) {
+    MachineThread mt;
+    mt.setup(PC2_RAMPS_1_4);
+    arduino.setPin(mt.machine.axis[0].pinMin, 0);
+    arduino.setPin(mt.machine.axis[1].pinMin, 0);
+    arduino.setPin(mt.machine.axis[2].pinMin, 0);
+    mt.loop();
+    mt.loop();
+    Serial.clear(); // banner
+
+    char cmd[100];
+    int id = pfm->id;
+    snprintf(cmd, sizeof(cmd), "{\"mov\":{\"1\":%d,\"2\":%d,\"3\":%d}}\n", id, 10 * id, 100 * id);
+    Serial.push(cmd);
+    mt.loop();
+    mt.loop();
+    pfm->status = mt.status;
+    pfm->zpulses = arduino.pulses(PC2_Z_STEP_PIN);
+    pfm->position = mt.machine.getMotorPosition();
+    pfm->output = Serial.output();
+    threadRunner.clear();
+}
+
+void test_fleet() {
+    cout << "TEST	: test_fleet() =====" << endl;
+
+    arduino.clear();
+    threadRunner.clear();
+    Serial.clear();
+    Serial.push("{}\n");
+
+    FleetMachine fleet[FLEET_SIZE];
+    std::thread threads[FLEET_SIZE];
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        fleet[i].id = i + 1;
+        threads[i] = std::thread(fleetMachine, &fleet[i]);
+    }
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        threads[i].join();
+    }
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        int id = fleet[i].id;
+        ASSERTEQUAL(STATUS_OK, fleet[i].status);
+        ASSERTEQUAL(100 * id, fleet[i].zpulses);
+        ASSERTQUAD(Quad<StepCoord>(id, 10 * id, 100 * id, 0), fleet[i].position);
+        char prefix[100];
+        snprintf(prefix, sizeof(prefix), "{\"s\":0,\"r\":{\"mov\":{\"1\":%d.000,", id);
+        ASSERTEQUAL(0, (int) fleet[i].output.find(prefix));
+    }
+
+    // this thread's MCU is untouched
+    ASSERTEQUAL(0, arduino.pulses(PC2_Z_STEP_PIN));
+    ASSERT(pThreadList == NULL);
+    ASSERTEQUAL(3, Serial.available());
+
+    Serial.clear();
+    cout << "TEST	: test_fleet() OK " << endl;
+}
+
 void test_sys() {
     cout << "TEST	: test_sys() =====" << endl;
 
@@ -1238,6 +1724,41 @@ void test_sys() {
     mt.loop();
     ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
 
+    Serial.clear();
+    Serial.push(JT("{'syslb':150,'sys':{'lb':''}}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(150, machine.latchBackoff);
+    ASSERTEQUALS(JT("{'s':0,'r':{'syslb':150,'sys':{'lb':150}},'t':0.000}\n"),
+                 Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // thread profile
+    ASSERTEQUAL('M', pThreadList->id);
+    pThreadList->runCount = 12;
+    pThreadList->runTicks = 30;
+    pThreadList->runMax = 5;
+    Serial.clear();
+    Serial.push(JT("{'systh':''}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'systh':{'M':[12,30,5]}},'t':0.000}\n"),
+                 Serial.output().c_str());
+    mt.loop();
+    Serial.clear();
+    Serial.push(JT("{'systh':0}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'systh':{'M':[0,0,0]}},'t':0.000}\n"),
+                 Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
     cout << "TEST	: test_sys() OK " << endl;
 }
 
@@ -1414,8 +1935,8 @@ void test_MTO_FPD() {
     ASSERTEQUAL(996, arduino.pulses(PC2_X_STEP_PIN)-xpulses);
     ASSERTQUAD(Quad<StepCoord>(1096, 1096, 1096, 100), mt.machine.getMotorPosition());
     ASSERTEQUALS(JT("{'s':0,'r':{'prb':"
-                    "{'1':1096,'2':1096,'3':1096,'4':100,'ip':false,"
-                    "'pn':2,'sd':800,'x':0.000,'y':-0.000,'z':-21.484}},'t':6.016}\n"),
+                    "{'1':1096,'2':1096,'3':1096,'4':100,'fd':0,'ip':false,"
+                    "'pn':2,'rp':0,'sd':800,'x':0.000,'y':-0.000,'z':-21.484}},'t':6.016}\n"),
                  Serial.output().c_str());
     test_ticks(1);	// tripped
     ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
@@ -1578,6 +2099,250 @@ void test_MTO_FPD() {
     cout << "TEST	: test_MTO_FPD() OK " << endl;
 }
 
+void test_MTO_FPD_prbg() {
+    cout << "TEST	: test_MTO_FPD_prbg() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+
+    // not available for MTO_RAW
+    Serial.push(JT("{'prbg':''}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_TOPOLOGY_NAME, mt.status);
+    Serial.output();
+    mt.loop();
+
+    Serial.push(JT("{'systo':1}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    machine.setMotorPosition(Quad<StepCoord>());
+    Serial.output();
+
+    // 10x2 grid with immediate contact at every point
+    arduino.setPin(PC2_PROBE_PIN, HIGH);
+    Serial.push(JT("{'prbg':{'x':-2,'y':-1,'dx':0.5,'dy':2,'nx':10,'ny':2,'pn':2}}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();	// initialize
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    ASSERTEQUAL(10, machine.op.grid.nx);
+    ASSERTEQUAL(2, machine.op.grid.ny);
+    ASSERTEQUALT(PROBE_GRID_ZHOP, machine.op.grid.zHop, 0.001);
+    mt.loop();	// travel to the first point
+    mt.loop();	// probe
+    mt.loop();	// rise vertically above the contact
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    XYZ3D xyz = machine.getXYZ3D();
+    ASSERTEQUALT(-2, xyz.x, 0.05);
+    ASSERTEQUALT(-1, xyz.y, 0.05);
+    ASSERTEQUALT(PROBE_GRID_ZHOP, xyz.z, 0.05);
+    mt.loop();	// travel level to the second point
+    xyz = machine.getXYZ3D();
+    ASSERTEQUALT(-1.5, xyz.x, 0.05);
+    ASSERTEQUALT(-1, xyz.y, 0.05);
+    ASSERTEQUALT(PROBE_GRID_ZHOP, xyz.z, 0.05);
+    int passes = 4;
+    for (; passes < 100 && mt.status == STATUS_BUSY_CALIBRATING; passes++) {
+        mt.loop();
+    }
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(2 + 3*19 + 1, passes); // rise, travel and probe each point, then rise
+    ASSERTEQUAL(20, machine.op.grid.index);
+
+    // serpentine: the last point is the first column of the second row
+    xyz = machine.getXYZ3D();
+    ASSERTEQUALT(-2, xyz.x, 0.05);
+    ASSERTEQUALT(1, xyz.y, 0.05);
+    ASSERTEQUALT(PROBE_GRID_ZHOP, xyz.z, 0.05);
+
+    string out = Serial.output();
+    size_t r0c0 = out.find(JT("{'prbg':{'r':0,'c':0,'z':["));
+    size_t r0c8 = out.find(JT("{'prbg':{'r':0,'c':8,'z':["));
+    size_t r1c2 = out.find(JT("{'prbg':{'r':1,'c':2,'z':["));
+    size_t r1c0 = out.find(JT("{'prbg':{'r':1,'c':0,'z':["));
+    size_t resp = out.find(JT("{'s':0,'r':{'prbg':"));
+    ASSERT(r0c0 != string::npos);
+    ASSERT(r0c0 < r0c8 && r0c8 != string::npos);
+    ASSERT(r0c8 < r1c2 && r1c2 != string::npos);
+    ASSERT(r1c2 < r1c0 && r1c0 != string::npos);
+    ASSERT(r1c0 < resp && resp != string::npos);
+
+    // grid fits and replaces the height map relative to the first point
+    ASSERTEQUAL(10, machine.heightMap.nx);
+    ASSERTEQUAL(2, machine.heightMap.ny);
+    ASSERTEQUALT(-2, machine.heightMap.x, 0.001);
+    ASSERTEQUALT(0.5, machine.heightMap.dx, 0.001);
+    ASSERT(!machine.heightMap.enabled);
+    ASSERTEQUAL(0, machine.heightMap.z[0]);
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // travel height must clear the surface
+    Serial.push(JT("{'prbg':{'nx':2,'pn':2,'zh':0}}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_VALUE_RANGE, mt.status);
+    Serial.output();
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    cout << "TEST	: test_MTO_FPD_prbg() OK " << endl;
+}
+
+void test_MTO_FPD_zmp() {
+    cout << "TEST	: test_MTO_FPD_zmp() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+    Serial.push(JT("{'systo':1}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    machine.setMotorPosition(Quad<StepCoord>());
+    Serial.output();
+
+    // bilinear interpolation, clamped at the edges
+    HeightMap &map = machine.heightMap;
+    map.x = -10;
+    map.y = -10;
+    map.dx = 20;
+    map.dy = 20;
+    map.nx = 2;
+    map.ny = 2;
+    map.z[0] = 0;
+    map.z[1] = 1000;
+    map.z[2] = 2000;
+    map.z[3] = 3000;
+    ASSERTEQUALT(0, map.height(-10, -10), 0.0001);
+    ASSERTEQUALT(1, map.height(10, -10), 0.0001);
+    ASSERTEQUALT(2, map.height(-10, 10), 0.0001);
+    ASSERTEQUALT(1.5, map.height(0, 0), 0.0001);
+    ASSERTEQUALT(0.5, map.height(0, -10), 0.0001);
+    ASSERTEQUALT(0, map.height(-20, -20), 0.0001);
+    ASSERTEQUALT(3, map.height(20, 20), 0.0001);
+
+    // uniform 1mm map
+    Serial.push(JT("{'zmp':{'x':-10,'y':-10,'dx':20,'dy':20,'nx':2,'ny':2,"
+                   "'z':[1,1,1,1],'on':true}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(map.enabled);
+    ASSERTEQUAL(1000, map.z[3]);
+    mt.loop();
+    Serial.output();
+
+    // compensated move: nominal XYZ is reported, motors are 1mm higher
+    Serial.push(JT("{'mov':{'x':1,'y':0,'z':0}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    XYZ3D xyz = machine.getXYZ3D();
+    ASSERTEQUALT(1, xyz.x, 0.01);
+    ASSERTEQUALT(0, xyz.y, 0.01);
+    ASSERTEQUALT(0, xyz.z, 0.01);
+    Step3D pulses = machine.delta.calcPulses(XYZ3D(1, 0, 1));
+    Quad<StepCoord> pos = machine.getMotorPosition();
+    ASSERTEQUALT(pulses.p1, pos.value[0], 2);
+    ASSERTEQUALT(pulses.p2, pos.value[1], 2);
+    ASSERTEQUALT(pulses.p3, pos.value[2], 2);
+    ASSERT(!machine.mapOffset.isZero());
+    ASSERT(!machine.stroke.offset.isZero());
+    ASSERTEQUAL(true, machine.stroke.isDone());
+    mt.loop();
+    Serial.output();
+
+    // disabled map: the next move removes the compensation
+    Serial.push(JT("{'zmpon':false}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    Serial.push(JT("{'mov':{'x':2}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(machine.mapOffset.isZero());
+    pulses = machine.delta.calcPulses(XYZ3D(2, 0, 0));
+    pos = machine.getMotorPosition();
+    ASSERTEQUALT(pulses.p1, pos.value[0], 1);
+    ASSERTEQUALT(pulses.p2, pos.value[1], 1);
+    ASSERTEQUALT(pulses.p3, pos.value[2], 1);
+    mt.loop();
+    Serial.output();
+
+    // map changes apply without a change of nominal position
+    Serial.push(JT("{'zmpon':true}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    Serial.push(JT("{'mov':{'x':2}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(!machine.mapOffset.isZero());
+    pulses = machine.delta.calcPulses(XYZ3D(2, 0, 1));
+    pos = machine.getMotorPosition();
+    ASSERTEQUALT(pulses.p1, pos.value[0], 2);
+    ASSERTEQUALT(pulses.p2, pos.value[1], 2);
+    ASSERTEQUALT(pulses.p3, pos.value[2], 2);
+    mt.loop();
+    Serial.push(JT("{'zmpon':false}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    Serial.push(JT("{'mov':{'x':2}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(machine.mapOffset.isZero());
+    pulses = machine.delta.calcPulses(XYZ3D(2, 0, 0));
+    pos = machine.getMotorPosition();
+    ASSERTEQUALT(pulses.p1, pos.value[0], 1);
+    ASSERTEQUALT(pulses.p2, pos.value[1], 1);
+    ASSERTEQUALT(pulses.p3, pos.value[2], 1);
+    mt.loop();
+    Serial.output();
+
+    // dvs strokes are compensated
+    Serial.push(JT("{'zmpon':true}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    mt.loop();
+    Quad<StepCoord> pos0 = machine.getMotorPosition();
+    Serial.push(JT("{'dvs':{'us':512,'1':[10,20],'2':[10,20],'3':[10,20]}}\n"));
+    for (int t = 0; t < 10 && mt.status != STATUS_OK; t++) {
+        test_ticks(MS_TICKS(100));
+    }
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(!machine.mapOffset.isZero());
+    Quad<StepCoord> pos1 = pos0 + Quad<StepCoord>(40, 40, 40, 0) + machine.mapOffset;
+    ASSERTQUAD(pos1, machine.getMotorPosition());
+    test_ticks(1);
+    Serial.output();
+
+    // map size is limited
+    Serial.push(JT("{'zmp':{'nx':10,'ny':10}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_VALUE_RANGE, mt.status);
+    ASSERTEQUAL(0, map.nx);
+    mt.loop();
+    Serial.output();
+
+    cout << "TEST	: test_MTO_FPD_zmp() OK " << endl;
+}
+
 void test_stroke_endpos() {
     cout << "TEST	: test_stroke_endpos() =====" << endl;
 
@@ -1756,6 +2521,64 @@ void test_pnp() {
     cout << "TEST	: test_pnp() OK " << endl;
 }
 
+void test_StrokeCompiler() {
+    cout << "TEST	: test_StrokeCompiler() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+    machine.setMotorPosition(Quad<StepCoord>());
+
+    // compiled strokes that move different motors run one after another
+    StrokeCompiler compiler;
+    compiler.setup();
+    PH5TYPE start[QUAD_ELEMENTS] = {0, 0, 0, 0};
+    istringstream in("100 0 0\nG1 Y200\n");
+    ostringstream out;
+    ASSERTEQUAL(0, compiler.compile(in, out, start));
+    istringstream dvs(out.str());
+    string line;
+    Quad<StepCoord> endPos[] = {
+        Quad<StepCoord>(100, 0, 0, 0),
+        Quad<StepCoord>(100, 200, 0, 0),
+    };
+    for (int i = 0; i < 2; i++) {
+        ASSERT(getline(dvs, line).good());
+        ASSERTEQUAL(0, (int) line.find("{\"dvs\":{"));
+        Serial.push(line + "\n");
+        test_ticks(1); // parse
+        ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+        for (int t = 0; t < 100 && mt.status != STATUS_OK; t++) {
+            test_ticks(MS_TICKS(100));
+        }
+        ASSERTEQUAL(STATUS_OK, mt.status);
+        ASSERTQUAD(endPos[i], machine.getMotorPosition());
+        test_ticks(1); // idle
+        ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+        Serial.output();
+    }
+    ASSERT(!getline(dvs, line));
+
+    // motors omitted from dvs do not move
+    machine.setMotorPosition(Quad<StepCoord>());
+    Serial.push(JT("{'dvs':{'us':512,'1':[10,20]}}\n"));
+    for (int t = 0; t < 10 && mt.status != STATUS_OK; t++) {
+        test_ticks(MS_TICKS(100));
+    }
+    ASSERTQUAD(Quad<StepCoord>(40, 0, 0, 0), machine.getMotorPosition());
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.push(JT("{'dvs':{'us':512,'2':[40,50]}}\n"));
+    for (int t = 0; t < 10 && mt.status != STATUS_OK; t++) {
+        test_ticks(MS_TICKS(100));
+    }
+    ASSERTQUAD(Quad<StepCoord>(40, 130, 0, 0), machine.getMotorPosition());
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.output();
+
+    cout << "TEST	: test_StrokeCompiler() OK " << endl;
+}
+
 void test_dvs() {
     cout << "TEST	: test_dvs() =====" << endl;
 
@@ -1877,6 +2700,12 @@ void test_errors() {
     test_error(mt, "{bad-json}\n", STATUS_JSON_PARSE_ERROR, "{'s':-403}\n");
     test_error(mt, "bad-json\n", STATUS_JSON_PARSE_ERROR, "{'s':-403}\n");
     test_error(mt, "{'xud':50000}\n", STATUS_VALUE_RANGE, "{'s':-133,'r':{'xud':50000},'t':0.000}\n");
+    test_error(mt, "{'sysabc':1}\n", STATUS_UNRECOGNIZED_NAME,
+               "{'s':-402,'r':{'sysabc':1},'e':'sysabc','t':0.000}\n");
+    test_error(mt, "{'xzz':1}\n", STATUS_UNRECOGNIZED_NAME,
+               "{'s':-402,'r':{'xzz':1},'e':'xzz','t':0.000}\n");
+    test_error(mt, "{'msgs':1}\n", STATUS_UNRECOGNIZED_NAME,
+               "{'s':-402,'r':{'msgs':1},'e':'msgs','t':0.000}\n");
 
     cout << "TEST	: test_errors() OK " << endl;
 }
@@ -1985,6 +2814,10 @@ void test_autoSync() {
 
     mt.loop();
 	string eeprom3 = eeprom_read_string(0);
+    ASSERTEQUAL(CONFIG_VERSION, eeprom_read_byte((uint8_t *) EECONFIG));
+	// restart with corrupt configuration image parses startup JSON
+	uint8_t *eepConfig = (uint8_t *) EECONFIG + 10;
+	eeprom_write_byte(eepConfig, eeprom_read_byte(eepConfig) ^ 1);
     ASSERTEQUALS(JT( "["
                      "{'sys':{'ah':1,'as':1,'ch':" HASH3 ",'db':0,'hp':3,'jp':0,"
 					 "'lb':200,'lh':0,'mv':12800,'om':3,'pc':2,'pi':11,'to':0,'tv':0.70}},"
@@ -2061,9 +2894,91 @@ void test_autoSync() {
 		VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, HASH3);
 	ASSERTEQUALS(buf, Serial.output().c_str());
 
+	// restart with configuration image only executes autoHome
+	eeprom_write_byte(eepConfig, eeprom_read_byte(eepConfig) ^ 1);
+	machine.autoSync = false;
+	machine.vMax = 1;
+	machine.syncHash = 0;
+	mt.status = STATUS_BUSY_SETUP;
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_EEPROM, mt.status);
+    mt.loop(); // load configuration image
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+	ASSERTEQUAL(true, machine.autoSync);
+	ASSERTEQUAL(12800, machine.vMax);
+	ASSERTEQUAL(hash3, machine.syncHash);
+	ASSERTEQUAL(hash3, machine.hash());
+	mt.command.requestRoot().printTo(buf, sizeof(buf));
+	ASSERTEQUALS(JT("[{'hom':''}]"), buf);
+
     cout << "TEST	: test_autoSync() OK " << endl;
 }
 
+void test_eeprom_wear() {
+    cout << "TEST	: test_eeprom_wear() =====" << endl;
+
+    arduino.clear();
+    threadRunner.clear();
+    MachineThread mt;
+    mt.machine.pDisplay = &testDisplay;
+    mt.setup(PC1_EMC02);
+    Machine & machine = mt.machine;
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    ASSERT(sizeof(MachineConfig) <= EECONFIG_SLOT_BYTES);
+
+    // first sync writes everything
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.syncConfig());
+    int32_t writes1 = eeprom_write_count;
+    ASSERT(writes1 > 0);
+    MachineConfig cfg;
+    ASSERTEQUAL(0, mt.readConfig(cfg));
+    ASSERTEQUAL(0, cfg.generation);
+
+    // unchanged configuration is not rewritten
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.syncConfig());
+    ASSERTEQUAL(writes1, eeprom_write_count);
+
+    // changed configuration rotates configuration image slots
+    machine.vMax = 12000;
+    machine.invalidateHash();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.syncConfig());
+    ASSERTEQUAL(1, mt.readConfig(cfg));
+    ASSERTEQUAL(1, cfg.generation);
+    ASSERTEQUAL(12000, cfg.vMax);
+    int32_t writes2 = eeprom_write_count;
+    machine.vMax = 11000;
+    machine.invalidateHash();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.syncConfig());
+    ASSERTEQUAL(0, mt.readConfig(cfg));
+    ASSERTEQUAL(2, cfg.generation);
+    ASSERTEQUAL(11000, cfg.vMax);
+    ASSERT(eeprom_write_count - writes2 < writes1);
+
+    // newest intact image is used
+    uint8_t *eepSlot0 = (uint8_t *) EECONFIG + 10;
+    eeprom_write_byte(eepSlot0, eeprom_read_byte(eepSlot0) ^ 1);
+    ASSERTEQUAL(1, mt.readConfig(cfg));
+    ASSERTEQUAL(12000, cfg.vMax);
+
+    // unchanged eep value is not rewritten
+    Serial.push(JT("{'eep':{'2100':'hello'}}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    int32_t writes3 = eeprom_write_count;
+    Serial.push(JT("{'eep':{'2100':'hello'}}\n"));
+    mt.loop();
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(writes3, eeprom_write_count);
+    ASSERTEQUALS("hello", eeprom_read_string((uint8_t *) 2100).c_str());
+
+    cout << "TEST	: test_eeprom_wear() OK " << endl;
+}
+
 void test_eep() {
     cout << "TEST	: test_eep() =====" << endl;
 
@@ -2166,6 +3081,18 @@ void test_eep() {
     test_ticks(1);
     ASSERTEQUALS(JT("{'systv':0.700}"), eeprom_read_string(0).c_str());
 
+    // "eep!" writes streamed group values straight to EEPROM
+    Serial.push(JT("{'eep!3000':{'x':''}}\n"));
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    test_ticks(1);
+    Serial.output();
+    string eepx = eeprom_read_string((uint8_t *) 3000);
+    ASSERTEQUAL(0, eepx.find(JT("{'x':{'dh':")));
+    ASSERT(eepx.find(JT("'ud':0}}")) != string::npos);
+
     // test restart
     mt.status = STATUS_BUSY_SETUP;
     machine.tvMax = 0.5;
@@ -2539,6 +3466,79 @@ void test_probe() {
     cout << "TEST	: test_probe() OK " << endl;
 }
 
+void test_probe_twoPhase() {
+    cout << "TEST	: test_probe_twoPhase() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+    int32_t zpulses = arduino.pulses(PC2_Z_STEP_PIN);
+    machine.setMotorPosition(Quad<StepCoord>(100, 100, 100, 100));
+    arduino.setPin(PC2_PROBE_PIN, LOW);
+    arduino.triggerPin(PC2_Z_STEP_PIN, zpulses+20, PC2_PROBE_PIN, HIGH); // contact
+    arduino.triggerPin(PC2_Z_STEP_PIN, zpulses+21, PC2_PROBE_PIN, LOW); // retracting
+    arduino.triggerPin(PC2_Z_STEP_PIN, zpulses+26, PC2_PROBE_PIN, HIGH); // contact
+
+    Serial.push(JT("{'prb':{'3':0,'fd':100,'pn':2,'rp':3}}\n"));
+    test_ticks(1);	// parse
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    test_ticks(1);	// initialize
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    ASSERTEQUAL(100, machine.op.probe.fastDelay);
+    ASSERTEQUAL(3, machine.op.probe.retract);
+    ASSERTQUAD(Quad<StepCoord>(100, 100, 100, 100), mt.machine.getMotorPosition());
+
+    delayMicsTotal = 0;
+    test_ticks(1);	// fast approach, retract and slow re-probe
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    ASSERTEQUAL(26, arduino.pulses(PC2_Z_STEP_PIN)-zpulses);
+    ASSERTEQUAL(23*100 + 3*800, delayMicsTotal);
+    ASSERTEQUAL(0, machine.op.probe.fastDelay);
+    ASSERTQUAD(Quad<StepCoord>(100, 100, 80, 100), mt.machine.getMotorPosition());
+
+    test_ticks(1);	// tripped
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERT(!machine.op.probe.probing);
+    ASSERTEQUAL(26, arduino.pulses(PC2_Z_STEP_PIN)-zpulses);
+    ASSERTQUAD(Quad<StepCoord>(100, 100, 80, 100), mt.machine.getMotorPosition());
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.output();
+
+    // fast approach without contact fails in one pass
+    zpulses = arduino.pulses(PC2_Z_STEP_PIN);
+    arduino.setPin(PC2_PROBE_PIN, LOW);
+    Serial.push(JT("{'prb':{'3':70,'fd':100,'pn':2}}\n"));
+    test_ticks(1);	// parse
+    test_ticks(1);	// initialize
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    test_ticks(1);	// fast approach
+    ASSERTEQUAL(STATUS_PROBE_FAILED, mt.status);
+    ASSERTEQUAL(10, arduino.pulses(PC2_Z_STEP_PIN)-zpulses);
+    ASSERTQUAD(Quad<StepCoord>(100, 100, 70, 100), mt.machine.getMotorPosition());
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.output();
+
+    // long probes pulse in bounded passes and can be cancelled
+    zpulses = arduino.pulses(PC2_Z_STEP_PIN);
+    Serial.push(JT("{'prb':{'3':-1000,'fd':100,'pn':2}}\n"));
+    test_ticks(1);	// parse
+    test_ticks(1);	// initialize
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    test_ticks(1);	// fast approach
+    ASSERTEQUAL(STATUS_BUSY_CALIBRATING, mt.status);
+    ASSERTEQUAL(PROBE_FAST_PULSES, arduino.pulses(PC2_Z_STEP_PIN)-zpulses);
+    Serial.push("\n");
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_CANCELLED, mt.status);
+    ASSERTEQUAL(PROBE_FAST_PULSES, arduino.pulses(PC2_Z_STEP_PIN)-zpulses);
+    test_ticks(1);
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.output();
+
+    cout << "TEST	: test_probe_twoPhase() OK " << endl;
+}
+
 void test_Home() {
     cout << "TEST	: test_Home() =====" << endl;
 
@@ -2952,7 +3952,11 @@ void test_ph5() {
     ASSERTEQUAL(0, Serial.available()); // expected parse
     ASSERTEQUAL(0, arduino.pulses(PC2_X_STEP_PIN) - xpulses);
 
+    arduino.tracePin(PC2_X_STEP_PIN);
+    arduino.tracePin(PC2_X_DIR_PIN);
+    arduino.traceStart(16384);
     mt.loop();	// command.process
+    arduino.traceStop();
     ASSERTEQUAL(STATUS_BUSY_MOVING, mt.status);
     ASSERTEQUAL(true, machine.stroke.isDone());
     ASSERTEQUALS(JT(""), Serial.output().c_str());
@@ -2960,6 +3964,15 @@ void test_ph5() {
     ASSERTEQUAL(LOW, arduino.getPin(PC2_X_DIR_PIN));	// reversing
     ASSERTEQUAL(6400, arduino.pulses(PC2_X_STEP_PIN) - xpulses);
     ASSERTQUAD(Quad<StepCoord>(0, 0, 0, 0), machine.getMotorPosition());
+    ASSERT(arduino.traceSize() < 16384); // whole stroke traced
+    int32_t stepFalls = 0;
+    for (size_t i = 0; i < arduino.traceSize(); i++) {
+        PinEvent event = arduino.traceEvent(i);
+        if (event.pin == PC2_X_STEP_PIN && event.level == LOW) {
+            stepFalls++;
+        }
+    }
+    ASSERTEQUAL(1 + 6400, stepFalls); // initial level and each pulse
 
     mt.loop();	// command.process (second stroke)
     ASSERTEQUAL(STATUS_BUSY_MOVING, mt.status);
@@ -3340,6 +4353,250 @@ void test_msg_cmt_idl() {
     cout << "TEST	: test_msg_cmt_idl() OK " << endl;
 }
 
+void test_xonxoff() {
+    cout << "TEST	: test_xonxoff() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+    Serial.push(JT("{'sysom':4}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(OUTPUT_XONXOFF, machine.outputMode);
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysom':4},'t':0.000}\n"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // input that arrives while busy is queued instead of cancelling
+    Serial.push(JT("{'sysmv':12000}\n{'sysmv':''}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    ASSERTEQUALS("\x13", Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysmv':12000},'t':0.000}\n\x11"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    ASSERTEQUALS("\x13", Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysmv':12000},'t':0.000}\n\x11"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // a filling receive buffer pauses input before the line is complete
+    Serial.push(JT("{'sysmv':12000,                                      "));
+    ASSERT(Serial.available() >= 48);
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_EOL, mt.status);
+    ASSERTEQUALS("\x13\x11", Serial.output().c_str());
+    Serial.push(JT("'systv':''}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    ASSERTEQUALS("\x13", Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    Serial.output();
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // MessagePack output cannot carry XON/XOFF
+    Serial.push(JT("{'sysom':12}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_VALUE_RANGE, mt.status);
+    ASSERTEQUAL(OUTPUT_XONXOFF, machine.outputMode);
+    Serial.output();
+
+    // disabling flow control resumes input
+    Serial.push(JT("{'sysom':0}\n"));
+    mt.loop();
+    ASSERTEQUALS("\x13", Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysom':0},'t':0.000}\n\x11"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+    Serial.push(JT("{'sysom':''}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysom':0},'t':0.000}\n"), Serial.output().c_str());
+
+    cout << "TEST	: test_xonxoff() OK " << endl;
+}
+
+void test_id() {
+    cout << "TEST	: test_id() =====" << endl;
+
+    MachineThread mt = test_setup();
+    Serial.push(JT("{'id':7,'sysmv':''}\n"));
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    ASSERTEQUALS("", Serial.output().c_str()); // no acknowledgement
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'id':7,'sysmv':12800},'t':0.000}\n"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    Serial.push(JT("{'id':'a1','sysmv':'','bad':1}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_UNRECOGNIZED_NAME, mt.status);
+    ASSERTEQUALS(JT("{'s':-402,'r':{'id':'a1','sysmv':12800,'bad':1},'e':'bad','t':0.000}\n"),
+                 Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // array responses show the last element and its id
+    Serial.push(JT("[{'id':1,'sysmv':''},{'id':2,'sysmv':''}]\n"));
+    mt.loop();
+    mt.loop();
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'id':2,'sysmv':12800},'t':0.000}\n"), Serial.output().c_str());
+
+    cout << "TEST	: test_id() OK " << endl;
+}
+
+void test_msgpack_output(const uint8_t *expected, size_t n) {
+    string output = Serial.output();
+    ASSERTEQUAL(n, output.size());
+    for (size_t i = 0; i < n; i++) {
+        ASSERTEQUAL(expected[i], (uint8_t) output[i]);
+    }
+}
+
+void test_msgpack() {
+    cout << "TEST	: test_msgpack() =====" << endl;
+
+    // decoder frames the top-level value without converting it
+    const uint8_t pack1[] = {
+        0x82, 0xa1, 'a', 0x93, 0xff, 0xd1, 0xfc, 0x18, 0xc3,
+        0xa1, 'b', 0xa2, '"', 'x'
+    };
+    MsgPackDecoder decoder;
+    char buf[100];
+    char *dst = buf;
+    for (size_t i = 0; i < sizeof(pack1); i++) {
+        Status status = decoder.decode(pack1[i], dst, buf + sizeof(buf));
+        ASSERTEQUAL(i < sizeof(pack1) - 1 ? STATUS_WAIT_EOL : STATUS_OK, status);
+    }
+    ASSERTEQUAL(sizeof(pack1), dst - buf);
+    ASSERTEQUAL(0, memcmp(pack1, buf, sizeof(pack1)));
+
+    // after an error, input is dropped until the next map or array header
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, decoder.decode(0x80, dst, buf + sizeof(buf)));
+    decoder.clear();
+    dst = buf;
+    ASSERTEQUAL(STATUS_WAIT_IDLE, decoder.decode(0xa1, dst, buf + sizeof(buf)));
+    ASSERTEQUAL(STATUS_WAIT_IDLE, decoder.decode('x', dst, buf + sizeof(buf)));
+    ASSERT(dst == buf);
+    ASSERTEQUAL(STATUS_OK, decoder.decode(0x80, dst, buf + sizeof(buf)));
+    decoder.clear();
+    dst = buf;
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, decoder.decode(0x01, dst, buf + sizeof(buf)));
+
+    // reader builds JSON tree in place
+    char pack2[] = {
+        (char) 0x92, (char) 0x81, (char) 0xa3, 's', 'y', 's', (char) 0x82,
+        (char) 0xa2, 't', 'v', (char) 0xca, 0x3f, 0x00, 0x00, 0x00,
+        (char) 0xa2, 'm', 'v', (char) 0xcd, 0x32, 0x00,
+        (char) 0x81, (char) 0xa3, 'h', 'o', 'm', (char) 0xa0
+    };
+    StaticJsonBuffer<JSON_OBJECT_SIZE(20)> jb;
+    JsonArray &jarr = jb.createArray();
+    MsgPackReader reader(pack2, sizeof(pack2));
+    ASSERT(!reader.isObject());
+    ASSERTEQUAL(STATUS_OK, reader.read(jarr));
+    jarr.printTo(buf, sizeof(buf));
+    ASSERTEQUALS(JT("[{'sys':{'tv':0.500,'mv':12800}},{'hom':''}]"), buf);
+    MsgPackReader reader2(pack2, sizeof(pack2) - 1);
+    JsonArray &jarr2 = jb.createArray();
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, reader2.read(jarr2));
+
+    MachineThread mt = test_setup();
+    Machine &machine = mt.machine;
+    Serial.push(JT("{'sysom':8}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysom':8},'t':0.000}\n"), Serial.output().c_str());
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    const uint8_t mv[] = { 0x81, 0xa5, 's', 'y', 's', 'm', 'v', 0xcd, 0x2e, 0xe0 };
+    for (size_t i = 0; i < sizeof(mv); i++) {
+        Serial.push(mv[i]);
+    }
+    mt.loop();
+    ASSERTEQUAL(STATUS_BUSY_PARSED, mt.status);
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(12000, machine.vMax);
+    const uint8_t mvOut[] = {
+        0x83, 0xa1, 's', 0x00, 0xa1, 'r', 0x81, 0xa5, 's', 'y', 's', 'm', 'v', 0xcd, 0x2e, 0xe0,
+        0xa1, 't', 0xca, 0x00, 0x00, 0x00, 0x00
+    };
+    test_msgpack_output(mvOut, sizeof(mvOut));
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    // a bad byte drops input until the next map header
+    const uint8_t bad[] = { 0x81, 0xa2, 'm', 'v', 0xc1, 0x12, 'x' };
+    for (size_t i = 0; i < sizeof(bad); i++) {
+        Serial.push(bad[i]);
+    }
+    mt.loop();
+    ASSERTEQUAL(STATUS_JSON_PARSE_ERROR, mt.status);
+    const uint8_t badOut[] = { 0x81, 0xa1, 's', 0xd1, 0xfe, 0x6d };
+    test_msgpack_output(badOut, sizeof(badOut));
+    ASSERTEQUAL(2, Serial.available());
+
+    const uint8_t tv[] = { 0x81, 0xa5, 's', 'y', 's', 't', 'v', 0xca, 0x3f, 0x00, 0x00, 0x00 };
+    for (size_t i = 0; i < sizeof(tv); i++) {
+        Serial.push(tv[i]);
+    }
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUALT(0.5, machine.tvMax, 0.0001);
+    const uint8_t tvOut[] = {
+        0x83, 0xa1, 's', 0x00, 0xa1, 'r', 0x81, 0xa5, 's', 'y', 's', 't', 'v', 0xca, 0x3f, 0x00, 0x00, 0x00,
+        0xa1, 't', 0xca, 0x00, 0x00, 0x00, 0x00
+    };
+    test_msgpack_output(tvOut, sizeof(tvOut));
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    const uint8_t om[] = { 0x81, 0xa5, 's', 'y', 's', 'o', 'm', 0x00 };
+    for (size_t i = 0; i < sizeof(om); i++) {
+        Serial.push(om[i]);
+    }
+    mt.loop();
+    mt.loop();
+    ASSERTEQUAL(STATUS_OK, mt.status);
+    ASSERTEQUAL(OUTPUT_ARRAY1, machine.outputMode);
+    const uint8_t omOut[] = {
+        0x83, 0xa1, 's', 0x00, 0xa1, 'r', 0x81, 0xa5, 's', 'y', 's', 'o', 'm', 0x00,
+        0xa1, 't', 0xca, 0x00, 0x00, 0x00, 0x00
+    };
+    test_msgpack_output(omOut, sizeof(omOut));
+    mt.loop();
+    ASSERTEQUAL(STATUS_WAIT_IDLE, mt.status);
+
+    Serial.push(JT("{'sysom':''}\n"));
+    mt.loop();
+    mt.loop();
+    ASSERTEQUALS(JT("{'s':0,'r':{'sysom':0},'t':0.000}\n"), Serial.output().c_str());
+
+    cout << "TEST	: test_msgpack() OK " << endl;
+}
+
 int main(int argc, char *argv[]) {
     LOGINFO3("INFO	: FireStep test v%d.%d.%d",
              VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
@@ -3356,11 +4613,17 @@ int main(int argc, char *argv[]) {
         //test_MTO_FPD();
         //test_eep();
         test_autoSync();
+        test_eeprom_wear();
     } else {
         test_Serial();
         test_Thread();
+        test_ThreadRunner();
+        test_ticksWrap();
+        test_cycleClock();
+        test_trace();
         test_Quad();
         test_Stroke();
+        test_StrokeBuilder_scale();
         test_Machine_step();
         test_Machine();
         test_ArduinoJson();
@@ -3372,8 +4635,10 @@ int main(int argc, char *argv[]) {
         test_PrettyPrint();
         test_Idle();
         test_Move();
+        test_fleet();
         test_PinConfig();
         test_dvs();
+        test_StrokeCompiler();
         test_sys();
         test_errors();
         test_ph5();
@@ -3383,10 +4648,17 @@ int main(int argc, char *argv[]) {
         test_io();
         test_eep();
         test_probe();
+        test_probe_twoPhase();
         test_DeltaCalculator();
         test_MTO_FPD();
+        test_MTO_FPD_prbg();
+        test_MTO_FPD_zmp();
         test_autoSync();
+        test_eeprom_wear();
 		test_msg_cmt_idl();
+        test_xonxoff();
+        test_id();
+        test_msgpack();
     }
 
     cout << "TEST	: END OF TEST main()" << endl;